@@ -18,7 +18,9 @@
 #include <unistd.h>
 #include <ctype.h>
 
-#define PORT 12345
+#include "keepalive.h"
+
+#define PORT 12345 /* when host:port gives none */
 #define BUF 8192
 
 /* read password without echo */
@@ -60,8 +62,18 @@ static void handle_incoming_and_redraw(const char *msg) {
 }
 
 int main(int argc, char *argv[]) {
-    char *host = "127.0.0.1";
-    if (argc >= 2) host = argv[1];
+    /* host[:port] */
+    char host[64] = "127.0.0.1";
+    int port = PORT;
+    if (argc >= 2) {
+        snprintf(host, sizeof(host), "%s", argv[1]);
+        char *colon = strchr(host, ':');
+        if (colon) {
+            *colon = '\0';
+            port = atoi(colon + 1);
+            if (port <= 0 || port > 65535) { fprintf(stderr, "bad port: %s\n", colon + 1); return 1; }
+        }
+    }
 
     char admin_name[128] = {0};
     char *pwd = NULL;
@@ -84,19 +96,21 @@ int main(int argc, char *argv[]) {
     if (sock < 0) { perror("socket"); return 1; }
     struct sockaddr_in serv = {0};
     serv.sin_family = AF_INET;
-    serv.sin_port = htons(PORT);
+    serv.sin_port = htons(port);
     if (inet_pton(AF_INET, host, &serv.sin_addr) <= 0) { perror("inet_pton"); close(sock); return 1; }
     if (connect(sock, (struct sockaddr *)&serv, sizeof(serv)) < 0) { perror("connect"); close(sock); return 1; }
 
     /* set line buffering for stdout so prompt and messages flush promptly */
     setvbuf(stdout, NULL, _IOLBF, 0);
 
-    printf("Connected to %s:%d as admin '%s'\n", host, PORT, admin_name);
-    printf("Enter admin commands (KICK <user>, MUTE <user>, UNMUTE <user>, BROADCAST <text>, USERS, ROOMS, QUIT)\n");
+    printf("Connected to %s:%d as admin '%s'\n", host, port, admin_name);
+    printf("Enter admin commands (KICK <user>, MUTE <user>, UNMUTE <user>, BROADCAST <text>, USERS, ROOMS, STATS, TRACE [n|DUMP], RELOADFILTER, LIMITS, LIMIT ..., QUIT)\n");
 
     fd_set rfds;
     int maxfd = sock > STDIN_FILENO ? sock : STDIN_FILENO;
     char inbuf[BUF];
+    char shown[BUF + PING_HOLD + 1];
+    ping_state_t ping = {0};
     char sendbuf[BUF];
 
     print_prompt();
@@ -115,10 +129,9 @@ int main(int argc, char *argv[]) {
 
         /* incoming server data */
         if (FD_ISSET(sock, &rfds)) {
-            ssize_t n = read(sock, inbuf, sizeof(inbuf) - 1);
+            ssize_t n = read(sock, inbuf, sizeof(inbuf));
             if (n > 0) {
-                inbuf[n] = '\0';
-                handle_incoming_and_redraw(inbuf);
+                if (ping_filter(&ping, sock, inbuf, n, shown)) handle_incoming_and_redraw(shown);
             } else if (n == 0) {
                 fprintf(stderr, "\nServer closed connection\n");
                 break;
@@ -0,0 +1,158 @@
+/* bench_fanout.c
+   Micro-benchmark for the recipient scan in broadcast_to_room().
+   Compares three connection table layouts over the same population:
+     aos-strcmp : original client_t with char room[64] and strcmp
+     aos-atom   : client_t with interned room ids
+     soa-hot    : hot parallel arrays (conn_live/conn_room/conn_out_fd)
+   "Sending" appends the fd to a list so only the table walk is measured.
+   Each layout runs warm (table stays cached) and cold (an 8 MB sweep
+   between fan-outs, like the rest of the event loop would cause).
+   Usage: ./bench_fanout [clients] [rooms] [iterations]
+*/
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static inline uint64_t ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+/* client_t as it was before atoms and the split: 144 bytes, inline names */
+typedef struct {
+    pid_t pid;
+    int to_child_fd;
+    int from_child_fd;
+    char username[64];
+    char room[64];
+    bool connected;
+    bool muted;
+    bool is_admin;
+} old_client_t;
+
+typedef struct {
+    pid_t pid;
+    int to_child_fd;
+    int from_child_fd;
+    uint32_t user;
+    uint32_t room;
+    bool connected;
+    bool muted;
+    bool is_admin;
+    char *in_buf;
+    size_t in_len, in_cap;
+    void *out_head, *out_tail;
+    size_t out_bytes;
+} atom_client_t;
+
+static volatile int sink;
+static char *evict_buf;
+#define EVICT_SIZE (8 << 20)
+
+/* push the tables out of cache, as the rest of the event loop would */
+static void evict(void) {
+    for (size_t i = 0; i < EVICT_SIZE; i += 64) evict_buf[i]++;
+}
+
+static void report(const char *name, const char *mode, uint64_t t, uint64_t recipients) {
+    printf("%-11s %-5s %8.2f cycles/recipient\n", name, mode,
+           (double)t / (recipients ? recipients : 1));
+}
+
+static int n, nrooms;
+static old_client_t *old;
+static atom_client_t *aos;
+static bool *live;
+static uint32_t *room;
+static int *out_fd;
+static int *sent;
+static char (*names)[64];
+
+static int scan_old(int it) {
+    const char *target = names[it % nrooms];
+    int k = 0;
+    for (int i = 0; i < n; ++i)
+        if (old[i].connected && strcmp(old[i].room, target) == 0) sent[k++] = old[i].to_child_fd;
+    return k;
+}
+
+static int scan_aos(int it) {
+    uint32_t target = it % nrooms + 1;
+    int k = 0;
+    for (int i = 0; i < n; ++i)
+        if (aos[i].connected && aos[i].room == target) sent[k++] = aos[i].to_child_fd;
+    return k;
+}
+
+static int scan_soa(int it) {
+    uint32_t target = it % nrooms + 1;
+    int k = 0;
+    for (int i = 0; i < n; ++i)
+        if (live[i] && room[i] == target) sent[k++] = out_fd[i];
+    return k;
+}
+
+static void run(const char *name, int (*scan)(int), int iters, bool cold) {
+    uint64_t t = 0, recips = 0;
+    for (int it = 0; it < iters; ++it) {
+        if (cold) evict();
+        uint64_t t0 = ticks();
+        int k = scan(it);
+        t += ticks() - t0;
+        recips += k;
+        sink = k;
+    }
+    report(name, cold ? "cold" : "warm", t, recips);
+}
+
+int main(int argc, char *argv[]) {
+    n = argc > 1 ? atoi(argv[1]) : 128;
+    nrooms = argc > 2 ? atoi(argv[2]) : 8;
+    int iters = argc > 3 ? atoi(argv[3]) : 200000;
+    if (n <= 0 || nrooms <= 0 || iters <= 0) return 1;
+
+    old = calloc(n, sizeof(*old));
+    aos = calloc(n, sizeof(*aos));
+    live = calloc(n, sizeof(*live));
+    room = calloc(n, sizeof(*room));
+    out_fd = calloc(n, sizeof(*out_fd));
+    sent = calloc(n, sizeof(*sent));
+    names = calloc(nrooms, 64);
+    evict_buf = calloc(1, EVICT_SIZE);
+
+    srand(42);
+    for (int r = 0; r < nrooms; ++r) snprintf(names[r], 64, "room-%d", r);
+    for (int i = 0; i < n; ++i) {
+        bool on = rand() % 10 != 0; /* ~90% of slots occupied */
+        int r = rand() % nrooms;
+        old[i].connected = aos[i].connected = live[i] = on;
+        old[i].to_child_fd = aos[i].to_child_fd = out_fd[i] = i + 3;
+        strcpy(old[i].room, names[r]);
+        aos[i].room = room[i] = r + 1;
+    }
+
+    int cold_iters = iters / 100 ? iters / 100 : 1;
+    run("aos-strcmp", scan_old, iters, false);
+    run("aos-atom", scan_aos, iters, false);
+    run("soa-hot", scan_soa, iters, false);
+    run("aos-strcmp", scan_old, cold_iters, true);
+    run("aos-atom", scan_aos, cold_iters, true);
+    run("soa-hot", scan_soa, cold_iters, true);
+
+    free(old); free(aos); free(live); free(room); free(out_fd); free(sent); free(names);
+    free(evict_buf);
+    return 0;
+}
@@ -0,0 +1,115 @@
+/* bench_filter.c
+   Throughput of the profanity filter (wordfilter_apply) per kernel.
+   Two corpora of chat-sized lines (8..200 bytes) are built from a fixed
+   vocabulary that includes the innocent words a substring matcher gets
+   wrong ("class", "analysis", "dickens"):
+     clean : no listed words at all, the common case
+     dirty : one line in eight carries a listed word, some obfuscated
+   Each line is copied and masked, so the copy is part of the cost. Every
+   figure is the median of seven runs; pin it to one core (taskset -c 0)
+   when comparing builds, best-of figures hide the noise.
+   Usage: ./bench_filter [wordfile] [passes]
+*/
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "matcher.h"
+#include "wordfilter.h"
+
+#define N_LINES 4096
+#define MAX_LINE 256
+#define RUNS 7
+
+static const char *vocab[] = {
+    "the", "and", "you", "that", "was", "for", "are", "with", "his", "they", "this",
+    "have", "from", "one", "had", "word", "but", "not", "what", "all", "were", "when",
+    "your", "can", "said", "there", "use", "each", "which", "she", "how", "their",
+    "will", "other", "about", "out", "many", "then", "them", "these", "some", "would",
+    "make", "like", "into", "time", "look", "two", "more", "write", "see", "number",
+    "way", "could", "people", "than", "first", "water", "been", "call", "who", "now",
+    "find", "long", "down", "day", "did", "get", "come", "made", "may", "part", "lol",
+    "ok", "class", "analysis", "dickens", "assistant", "cocktail", "scunthorpe",
+    "passion", "grasshopper", "cockpit", "therapist", "Sussex", "Hello,", "2024", ":)",
+};
+static const char *dirty[] = {"fuck", "FUCKING", "sh1t", "a55", "fuuuuck", "b1tch",
+                              "bull$hit", "pissed off", "\xef\xbd\x86\xef\xbd\x95\xef\xbd\x83\xef\xbd\x8b"};
+
+static char lines[2][N_LINES][MAX_LINE];
+static size_t lens[2][N_LINES];
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void build(int which) {
+    size_t nv = sizeof(vocab) / sizeof(*vocab), nd = sizeof(dirty) / sizeof(*dirty);
+    for (int i = 0; i < N_LINES; ++i) {
+        size_t target = 8 + rand() % 193, n = 0;
+        int bad = which == 1 && i % 8 == 0 ? rand() % 4 : -1; /* word slot to taint */
+        for (int w = 0; n < target; ++w) {
+            const char *s = w == bad ? dirty[rand() % nd] : vocab[rand() % nv];
+            size_t l = strlen(s);
+            if (n + l + 1 >= MAX_LINE) break;
+            if (n) lines[which][i][n++] = ' ';
+            memcpy(lines[which][i] + n, s, l);
+            n += l;
+        }
+        lines[which][i][n] = '\0';
+        lens[which][i] = n;
+    }
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void run(const char *corpus, int which, int passes) {
+    char buf[MAX_LINE];
+    size_t bytes = 0, hits = 0;
+    double t[RUNS];
+    for (int rep = 0; rep < RUNS; ++rep) {
+        bytes = hits = 0;
+        double t0 = now();
+        for (int p = 0; p < passes; ++p)
+            for (int i = 0; i < N_LINES; ++i) {
+                memcpy(buf, lines[which][i], lens[which][i] + 1);
+                hits += wordfilter_apply(buf, lens[which][i]);
+                bytes += lens[which][i];
+            }
+        t[rep] = now() - t0;
+    }
+    qsort(t, RUNS, sizeof(*t), cmp_double);
+    double dt = t[RUNS / 2];
+    printf("%-7s %-6s %8.1f MB/s %7.1f ns/line %8zu matches\n", matcher_kernel(), corpus,
+           bytes / dt / 1e6, dt * 1e9 / ((double)passes * N_LINES), hits);
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = argc > 1 ? argv[1] : "filter.words";
+    int passes = argc > 2 ? atoi(argv[2]) : 200;
+    if (passes <= 0) return 1;
+    int n = wordfilter_load(path);
+    if (n < 0) {
+        perror(path);
+        return 1;
+    }
+    printf("%d words from %s, %d lines x %d passes\n", n, path, N_LINES, passes);
+    srand(42);
+    build(0);
+    build(1);
+
+    static const char *kernels[] = {"avx2", "ssse3", "scalar"};
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(*kernels); ++k) {
+        if (matcher_use_kernel(kernels[k]) < 0) continue;
+        run("clean", 0, passes);
+        run("dirty", 1, passes);
+    }
+    return 0;
+}
@@ -0,0 +1,151 @@
+/* bus.c
+   peer[k] is our end of the socketpair to shard k (-1 for ourselves).
+   Queued frames are malloc'd and kept per peer in FIFO order; once a
+   peer has a backlog every new frame joins it, so order is preserved.
+*/
+#define _GNU_SOURCE
+#include "bus.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define BUS_QUEUE_MAX (4 * 1024 * 1024) /* bytes waiting for one peer */
+
+typedef struct bus_frame {
+    struct bus_frame *next;
+    size_t len;
+    char data[];
+} bus_frame_t;
+
+static unsigned n_shards = 1, self_id = 0;
+static int pairs[BUS_MAX_SHARDS][BUS_MAX_SHARDS]; /* [a][b]: a's end to b, before attach */
+static int peer[BUS_MAX_SHARDS] = {[0 ... BUS_MAX_SHARDS - 1] = -1};
+static bus_frame_t *q_head[BUS_MAX_SHARDS], *q_tail[BUS_MAX_SHARDS];
+static size_t q_bytes[BUS_MAX_SHARDS];
+
+int bus_init(unsigned n) {
+    if (n < 2 || n > BUS_MAX_SHARDS) return -1;
+    for (unsigned a = 0; a < n; ++a) pairs[a][a] = -1;
+    for (unsigned a = 0; a < n; ++a)
+        for (unsigned b = a + 1; b < n; ++b) {
+            int sv[2];
+            if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) < 0)
+                return -1;
+            pairs[a][b] = sv[0];
+            pairs[b][a] = sv[1];
+        }
+    n_shards = n;
+    return 0;
+}
+
+void bus_attach(unsigned self) {
+    self_id = self;
+    for (unsigned a = 0; a < n_shards; ++a)
+        for (unsigned b = 0; b < n_shards; ++b) {
+            if (a == b) continue;
+            if (a == self) peer[b] = pairs[a][b];
+            else close(pairs[a][b]);
+        }
+    peer[self] = -1;
+}
+
+unsigned bus_self(void) {
+    return self_id;
+}
+
+unsigned bus_shards(void) {
+    return n_shards;
+}
+
+unsigned bus_owner(uint32_t hash) {
+    return (unsigned)(((uint64_t)hash * n_shards) >> 32);
+}
+
+/* write queued frames for peer k until it would block */
+static void flush_peer(unsigned k) {
+    while (q_head[k]) {
+        bus_frame_t *f = q_head[k];
+        if (send(peer[k], f->data, f->len, MSG_NOSIGNAL) < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) return;
+            /* peer is gone: nothing queued for it can be delivered */
+        }
+        q_head[k] = f->next;
+        if (!q_head[k]) q_tail[k] = NULL;
+        q_bytes[k] -= f->len;
+        free(f);
+    }
+}
+
+bool bus_send(unsigned to, const char *frame, size_t len) {
+    if (to >= n_shards || peer[to] < 0 || len > BUS_MAX_FRAME) return false;
+    if (!q_head[to]) {
+        ssize_t w;
+        do w = send(peer[to], frame, len, MSG_NOSIGNAL);
+        while (w < 0 && errno == EINTR);
+        if (w >= 0) return true;
+        if (errno != EAGAIN) return false;
+    }
+    if (q_bytes[to] + len > BUS_QUEUE_MAX) return false;
+    bus_frame_t *f = malloc(sizeof(*f) + len);
+    if (!f) return false;
+    f->next = NULL;
+    f->len = len;
+    memcpy(f->data, frame, len);
+    if (q_tail[to]) q_tail[to]->next = f;
+    else q_head[to] = f;
+    q_tail[to] = f;
+    q_bytes[to] += len;
+    return true;
+}
+
+void bus_fds(fd_set *rfds, fd_set *wfds, int *maxfd) {
+    for (unsigned k = 0; k < n_shards; ++k) {
+        if (peer[k] < 0) continue;
+        FD_SET(peer[k], rfds);
+        if (q_head[k]) FD_SET(peer[k], wfds);
+        if (peer[k] > *maxfd) *maxfd = peer[k];
+    }
+}
+
+void bus_handle(fd_set *rfds, fd_set *wfds, bus_deliver_fn deliver) {
+    static char buf[BUS_MAX_FRAME + 1];
+    for (unsigned k = 0; k < n_shards; ++k) {
+        if (peer[k] < 0) continue;
+        if (FD_ISSET(peer[k], wfds)) flush_peer(k);
+        if (!FD_ISSET(peer[k], rfds)) continue;
+        /* a bounded batch, so one busy peer cannot starve the rest */
+        for (int n = 0; n < 64 && peer[k] >= 0; ++n) {
+            ssize_t r = recv(peer[k], buf, BUS_MAX_FRAME, 0);
+            if (r < 0 && errno == EINTR) continue;
+            if (r < 0) break;
+            if (r == 0) {
+                /* shard exited; drop the link and anything queued for it */
+                close(peer[k]);
+                peer[k] = -1;
+                while (q_head[k]) {
+                    bus_frame_t *f = q_head[k];
+                    q_head[k] = f->next;
+                    free(f);
+                }
+                q_tail[k] = NULL;
+                q_bytes[k] = 0;
+                break;
+            }
+            buf[r] = '\0';
+            deliver(k, buf, r);
+        }
+    }
+}
+
+void bus_detach(void) {
+    for (unsigned k = 0; k < n_shards; ++k) {
+        if (peer[k] >= 0) close(peer[k]);
+        peer[k] = -1;
+        q_head[k] = q_tail[k] = NULL;
+        q_bytes[k] = 0;
+    }
+}
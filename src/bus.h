@@ -0,0 +1,48 @@
+/* bus.h
+   Local message bus between the shards of a multi-process server. Every
+   pair of shards shares a SOCK_SEQPACKET socketpair, created before the
+   shards fork, so each frame arrives whole and in order per peer. Sends
+   never block: a frame the peer cannot take yet is queued and written
+   when select() reports the socket writable.
+*/
+#ifndef BUS_H
+#define BUS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/select.h>
+
+#define BUS_MAX_SHARDS 16
+#define BUS_MAX_FRAME (64 * 1024)
+
+typedef void (*bus_deliver_fn)(unsigned from, char *frame, size_t len);
+
+/* create the mesh for n shards (n >= 2); call once, before forking */
+int bus_init(unsigned n);
+
+/* in shard self after the fork (shard 0 too): keep self's ends only */
+void bus_attach(unsigned self);
+
+unsigned bus_self(void);
+unsigned bus_shards(void); /* 1 when the bus is not in use */
+
+/* shard owning a name with this hash: shards split the hash space into
+   equal ranges */
+unsigned bus_owner(uint32_t hash);
+
+/* queue a frame for shard to; false if it is too big or the peer's queue
+   is full (the frame is dropped) */
+bool bus_send(unsigned to, const char *frame, size_t len);
+
+/* add the peer sockets to the select sets */
+void bus_fds(fd_set *rfds, fd_set *wfds, int *maxfd);
+
+/* read whatever arrived (frames are NUL-terminated for the callback) and
+   write out queued frames */
+void bus_handle(fd_set *rfds, fd_set *wfds, bus_deliver_fn deliver);
+
+/* close the peer sockets (connection children call this) */
+void bus_detach(void);
+
+#endif
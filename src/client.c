@@ -1,6 +1,6 @@
 /* client.c
    Simple interactive client that sends raw input to server.
-   Supports /nick, /join, /rooms, /history, /pm, /admin, /quit
+   Supports /nick, /join, /rooms, /more, /history, /search, /pm, /admin, /quit
 */
 #include <arpa/inet.h>
 #include <errno.h>
@@ -12,27 +12,41 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
-#define PORT 12345
+#include "keepalive.h"
+
+#define PORT 12345 /* when host:port gives none */
 #define BUF 8192
 
 static inline void trim_newline(char *s) { if (!s) return; s[strcspn(s, "\r\n")] = '\0'; }
 
 int main(int argc, char *argv[]) {
-    char *host = "127.0.0.1";
-    if (argc >= 2) host = argv[1];
+    /* host[:port] */
+    char host[64] = "127.0.0.1";
+    int port = PORT;
+    if (argc >= 2) {
+        snprintf(host, sizeof(host), "%s", argv[1]);
+        char *colon = strchr(host, ':');
+        if (colon) {
+            *colon = '\0';
+            port = atoi(colon + 1);
+            if (port <= 0 || port > 65535) { fprintf(stderr, "bad port: %s\n", colon + 1); return 1; }
+        }
+    }
     int sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock < 0) { perror("socket"); return 1; }
     struct sockaddr_in serv = {0};
     serv.sin_family = AF_INET;
-    serv.sin_port = htons(PORT);
+    serv.sin_port = htons(port);
     if (inet_pton(AF_INET, host, &serv.sin_addr) <= 0) { perror("inet_pton"); return 1; }
     if (connect(sock, (struct sockaddr *)&serv, sizeof(serv)) < 0) { perror("connect"); return 1; }
 
-    printf("Connected to %s:%d\n", host, PORT);
-    printf("Commands: /nick <name>, /join <room>, /rooms, /history, /pm <user> <msg>, /admin <pwd> <CMD>, /quit\n");
+    printf("Connected to %s:%d\n", host, port);
+    printf("Commands: /nick <name>, /join <room>, /rooms, /more, /history, /search <text>, /pm <user> <msg>, /admin <pwd> <CMD>, /quit\n");
 
     fd_set rfds;
     char inbuf[BUF];
+    char shown[BUF + PING_HOLD + 1];
+    ping_state_t ping = {0};
     while (1) {
         FD_ZERO(&rfds);
         FD_SET(0, &rfds);
@@ -41,10 +55,10 @@ int main(int argc, char *argv[]) {
         int rv = select(maxfd + 1, &rfds, NULL, NULL, NULL);
         if (rv < 0) { if (errno == EINTR) continue; perror("select"); break; }
         if (FD_ISSET(sock, &rfds)) {
-            ssize_t n = read(sock, inbuf, sizeof(inbuf) - 1);
+            ssize_t n = read(sock, inbuf, sizeof(inbuf));
             if (n <= 0) { printf("Disconnected from server\n"); break; }
-            inbuf[n] = '\0';
-            printf("%s", inbuf);
+            ping_filter(&ping, sock, inbuf, n, shown);
+            printf("%s", shown);
         }
         if (FD_ISSET(0, &rfds)) {
             if (!fgets(inbuf, sizeof(inbuf), stdin)) break;
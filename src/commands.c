@@ -0,0 +1,38 @@
+/* commands.c
+   Lookup over the generated tables in cmd_table.h (see gen_cmdtable.c).
+*/
+#include "commands.h"
+
+#include <string.h>
+
+typedef struct {
+    const char *name; /* NULL for an empty slot */
+    uint8_t len;
+    int16_t id;
+} cmd_slot_t;
+
+typedef struct {
+    uint32_t seed;
+    unsigned bits;
+    const cmd_slot_t *slots;
+} cmd_layer_table_t;
+
+#include "cmd_table.h"
+
+static const bool takes_args[CMD_ID_COUNT] = {
+#define CMD(layer, id, name, args) [id] = args,
+#include "commands.def"
+#undef CMD
+};
+
+cmd_id_t cmd_lookup(cmd_layer_t layer, const char *s, size_t len) {
+    if (len == 0 || len > 255) return CMD_NONE;
+    const cmd_layer_table_t *t = &cmd_tables[layer];
+    const cmd_slot_t *e = &t->slots[cmd_hash(s, len, t->seed, t->bits)];
+    if (e->len != len || memcmp(e->name, s, len) != 0) return CMD_NONE;
+    return (cmd_id_t)e->id;
+}
+
+bool cmd_takes_args(cmd_id_t id) {
+    return id >= 0 && id < CMD_ID_COUNT && takes_args[id];
+}
@@ -0,0 +1,45 @@
+/* commands.h
+   Constant-time command recognition. Each layer (parent frames, admin
+   actions, slash commands, shard bus and peer frames) has a perfect hash
+   generated from commands.def, so a lookup is one multiply, one table
+   load and one memcmp no matter how many commands exist.
+*/
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    CMD_LAYER_FRAME,
+    CMD_LAYER_ADMIN,
+    CMD_LAYER_SLASH,
+    CMD_LAYER_BUS,
+    CMD_LAYER_PEER,
+    CMD_LAYER_COUNT
+} cmd_layer_t;
+
+typedef enum {
+    CMD_NONE = -1,
+#define CMD(layer, id, name, args) id,
+#include "commands.def"
+#undef CMD
+    CMD_ID_COUNT
+} cmd_id_t;
+
+/* shared by the generator and the lookup; keys on the first two bytes,
+   the last byte and the length */
+static inline uint32_t cmd_hash(const char *s, size_t len, uint32_t seed, unsigned bits) {
+    uint32_t k = (uint8_t)s[0] | (uint32_t)(uint8_t)(len > 1 ? s[1] : 0) << 8 |
+                 (uint32_t)(uint8_t)s[len - 1] << 16 | (uint32_t)(len & 0xff) << 24;
+    return (k * seed) >> (32 - bits);
+}
+
+/* id of the command s[0..len) in layer, or CMD_NONE */
+cmd_id_t cmd_lookup(cmd_layer_t layer, const char *s, size_t len);
+
+/* whether the command is written with arguments after it */
+bool cmd_takes_args(cmd_id_t id);
+
+#endif
@@ -0,0 +1,50 @@
+/* config.c
+   Line parser for config.h. Values are copied to the heap and never
+   freed; a config file is read once.
+*/
+#define _GNU_SOURCE
+#include "config.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CONFIG_LINE_MAX 1024
+
+static char *trim(char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    char *e = s + strlen(s);
+    while (e > s && isspace((unsigned char)e[-1])) e--;
+    *e = '\0';
+    return s;
+}
+
+int config_load(const char *path, config_fn apply) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    char line[CONFIG_LINE_MAX];
+    int lineno = 0, rc = 0;
+    while (rc == 0 && fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *s = trim(line);
+        if (!*s || *s == '#') continue;
+        char *eq = strchr(s, '=');
+        if (!eq) {
+            fprintf(stderr, "%s:%d: expected key = value\n", path, lineno);
+            rc = -1;
+            break;
+        }
+        *eq = '\0';
+        char *key = trim(s), *value = strdup(trim(eq + 1));
+        if (!value || apply(key, value) < 0) {
+            fprintf(stderr, "%s:%d: bad setting %s\n", path, lineno, key);
+            rc = -1;
+        }
+    }
+    fclose(f);
+    return rc;
+}
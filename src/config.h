@@ -0,0 +1,18 @@
+/* config.h
+   Settings file read once at startup: one "key = value" per line, blank
+   lines and '#' comments ignored, surrounding whitespace trimmed. The
+   server's keys are its long option names, so the same setting can come
+   from the file or the command line.
+*/
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/* handle one setting; return -1 to reject it. value stays valid for the
+   life of the process. */
+typedef int (*config_fn)(const char *key, const char *value);
+
+/* returns 0, or -1 if the file cannot be read or a line is malformed or
+   rejected (reported on stderr as path:line) */
+int config_load(const char *path, config_fn apply);
+
+#endif
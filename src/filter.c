@@ -1,59 +1,21 @@
-/* filter.c - naive profanity filter */
+/* filter.c - profanity filter: masks listed words, case-insensitively.
+   Reads the word list (default filter.words), then filters stdin line by
+   line. The server uses the same list and matcher in-process. */
 #include <stdio.h>
 #include <string.h>
 
-int main() {
+#include "wordfilter.h"
+
+int main(int argc, char *argv[]) {
+    const char *path = argc > 1 ? argv[1] : "filter.words";
+    if (wordfilter_load(path) < 0) {
+        perror(path);
+        return 1;
+    }
     char buf[8192];
-    if (!fgets(buf, sizeof(buf), stdin)) return 0;
-    const char *bad[] = {"nigga","fuck","shit","bollocks","bugger","ass","asshole","anal"
-,"blowjob"
-,"clitoris"
-,"dildo"
-,"ejaculation"
-,"genital"
-,"masturbate"
-,"penis"
-,"scrotum"
-,"testicle"
-,"vagina"
-,"wank"
-,"bastard"
-,"bitch"
-,"bullshit"
-,"cocksucker"
-,"cock"
-,"cunt"
-,"dick"
-,"douchebag"
-,"fuck"
-,"motherfucker"
-,"niga"
-,"nigga"
-,"nigger"
-,"piss"
-,"prick"
-,"pussy"
-,"shit"
-,"slut"
-,"whore"
-,"crap"
-,"douche"
-,"feck"
-,"jerk"
-,"pissed"
-,"pissed off"
-,"slag"
-,"tits"
-,"twat"
-,"evilword", NULL};
-    for (int i = 0; bad[i]; ++i) {
-        char *p = buf;
-        size_t blen = strlen(bad[i]);
-        while ((p = strstr(p, bad[i]))) {
-            memset(p, '*', blen);
-            p += blen;
-        }
+    while (fgets(buf, sizeof(buf), stdin)) {
+        wordfilter_apply(buf, strlen(buf));
+        printf("%s", buf);
     }
-    printf("%s", buf);
     return 0;
 }
@@ -0,0 +1,69 @@
+/* filtercache.c
+   A direct-mapped table per thread: no locks, no sharing, and a bounded
+   footprint (FC_SLOTS entries of 88 bytes, allocated on first use). The
+   hash only picks the slot and rejects quickly; a hit also compares the
+   stored text, so a collision can never hand back another message's
+   output. The filter only ever turns bytes into '*', so the output is
+   kept as a bitmap of those bytes (FC_MAX_LEN is at most 64): a clean
+   message stores nothing beyond its text.
+*/
+#include "filtercache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define FC_SLOTS 1024 /* power of two */
+
+typedef struct {
+    uint64_t hash;
+    uint64_t masked; /* bit i: byte i came out as '*'; 0 when clean */
+    unsigned gen;    /* 0 = empty (generations start at 1) */
+    uint8_t len;
+    char text[FC_MAX_LEN];
+} fc_entry_t;
+
+static __thread fc_entry_t *table = NULL;
+
+static uint64_t hash_text(const char *s, size_t len) {
+    uint64_t h = 14695981039346656037ull; /* FNV-1a */
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+int filtercache_get(const char *text, size_t len, unsigned gen, char *out, uint64_t *hash) {
+    *hash = 0;
+    if (len == 0 || len > FC_MAX_LEN || gen == 0) return 0;
+    uint64_t h = hash_text(text, len);
+    *hash = h;
+    if (table) {
+        const fc_entry_t *e = &table[h & (FC_SLOTS - 1)];
+        if (e->gen == gen && e->hash == h && e->len == len && memcmp(e->text, text, len) == 0) {
+            memcpy(out, e->text, len);
+            for (uint64_t m = e->masked; m; m &= m - 1) out[__builtin_ctzll(m)] = '*';
+            out[len] = '\0';
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void filtercache_put(uint64_t hash, const char *text, const char *filtered, size_t len,
+                     unsigned gen) {
+    if (len == 0 || len > FC_MAX_LEN || gen == 0) return;
+    uint64_t masked = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (filtered[i] == text[i]) continue;
+        if (filtered[i] != '*') return; /* not a masking: don't cache it */
+        masked |= 1ull << i;
+    }
+    if (!table && !(table = calloc(FC_SLOTS, sizeof(*table)))) return;
+    fc_entry_t *e = &table[hash & (FC_SLOTS - 1)];
+    e->hash = hash;
+    e->masked = masked;
+    e->gen = gen;
+    e->len = (uint8_t)len;
+    memcpy(e->text, text, len);
+}
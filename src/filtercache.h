@@ -0,0 +1,23 @@
+/* filtercache.h
+   Per-thread memo of recent filter results for short messages. Chat
+   traffic repeats itself ("ok", "lol", bot lines), so the exact text is
+   looked up before the matcher runs. Entries are tagged with the word
+   list generation and go stale on reload.
+*/
+#ifndef FILTERCACHE_H
+#define FILTERCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FC_MAX_LEN 64 /* longer messages are not cached; at most 64 */
+
+/* On a hit, write the filtered text (len bytes plus '\0') to out and
+   return 1. *hash is set either way for a following filtercache_put. */
+int filtercache_get(const char *text, size_t len, unsigned gen, char *out, uint64_t *hash);
+
+/* remember filtered as the result for text (same length) under gen */
+void filtercache_put(uint64_t hash, const char *text, const char *filtered, size_t len,
+                     unsigned gen);
+
+#endif
@@ -0,0 +1,152 @@
+/* filterpool.c
+   A mutex/condvar work queue feeds the workers; the queue is only held
+   for a pointer swap, the filtering runs unlocked. A finished job sets
+   its done flag (release) and bumps the eventfd. Per-key FIFOs live on
+   the loop's thread only: on wake-up each key's head is delivered while
+   it is done, so a slow job holds back its own room and nothing else.
+*/
+#define _GNU_SOURCE
+#include "filterpool.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+static pthread_t workers[FP_MAX_THREADS];
+static unsigned n_workers = 0;
+static pthread_mutex_t q_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t q_cond = PTHREAD_COND_INITIALIZER;
+static fp_job_t *q_head = NULL, *q_tail = NULL;
+static bool stopping = false;
+static int done_fd = -1;
+static fp_work_fn work_fn = NULL;
+
+/* loop thread only */
+static fp_job_t **key_head = NULL, **key_tail = NULL;
+static unsigned n_keys = 0;
+
+static void *worker_main(void *arg) {
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&q_lock);
+        while (!q_head && !stopping) pthread_cond_wait(&q_cond, &q_lock);
+        if (stopping) {
+            pthread_mutex_unlock(&q_lock);
+            return NULL;
+        }
+        fp_job_t *j = q_head;
+        q_head = j->next;
+        if (!q_head) q_tail = NULL;
+        pthread_mutex_unlock(&q_lock);
+
+        work_fn(j->text, j->len);
+        atomic_store_explicit(&j->done, 1, memory_order_release);
+        /* can only fail once the counter saturates, and then it is readable */
+        uint64_t one = 1;
+        ssize_t w = write(done_fd, &one, sizeof(one));
+        (void)w;
+    }
+}
+
+int filterpool_start(unsigned threads, unsigned nkeys, fp_work_fn work) {
+    if (threads == 0 || nkeys == 0) return -1;
+    if (threads > FP_MAX_THREADS) threads = FP_MAX_THREADS;
+    key_head = calloc(nkeys, sizeof(*key_head));
+    key_tail = calloc(nkeys, sizeof(*key_tail));
+    done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!key_head || !key_tail || done_fd < 0) goto fail;
+    n_keys = nkeys;
+    work_fn = work;
+    stopping = false;
+    for (unsigned t = 0; t < threads; ++t) {
+        if (pthread_create(&workers[t], NULL, worker_main, NULL) != 0) break;
+        n_workers++;
+    }
+    if (n_workers > 0) return 0;
+fail:
+    if (done_fd >= 0) close(done_fd);
+    done_fd = -1;
+    free(key_head);
+    free(key_tail);
+    key_head = key_tail = NULL;
+    n_keys = 0;
+    return -1;
+}
+
+unsigned filterpool_threads(void) {
+    return n_workers;
+}
+
+bool filterpool_pending(unsigned key) {
+    return key < n_keys && key_head[key] != NULL;
+}
+
+void filterpool_submit(fp_job_t *j) {
+    j->next = j->key_next = NULL;
+    atomic_store_explicit(&j->done, 0, memory_order_relaxed);
+    if (key_tail[j->key]) key_tail[j->key]->key_next = j;
+    else key_head[j->key] = j;
+    key_tail[j->key] = j;
+
+    pthread_mutex_lock(&q_lock);
+    if (q_tail) q_tail->next = j;
+    else q_head = j;
+    q_tail = j;
+    pthread_cond_signal(&q_cond);
+    pthread_mutex_unlock(&q_lock);
+}
+
+void filterpool_fds(fd_set *rfds, int *maxfd) {
+    if (done_fd < 0) return;
+    FD_SET(done_fd, rfds);
+    if (done_fd > *maxfd) *maxfd = done_fd;
+}
+
+void filterpool_handle(fd_set *rfds, fp_deliver_fn deliver) {
+    if (done_fd < 0 || !FD_ISSET(done_fd, rfds)) return;
+    uint64_t n;
+    if (read(done_fd, &n, sizeof(n)) < 0) return;
+    for (unsigned k = 0; k < n_keys; ++k) {
+        fp_job_t *j;
+        while ((j = key_head[k]) && atomic_load_explicit(&j->done, memory_order_acquire)) {
+            key_head[k] = j->key_next;
+            if (!key_head[k]) key_tail[k] = NULL;
+            deliver(j);
+        }
+    }
+}
+
+void filterpool_drain(fp_deliver_fn deliver) {
+    for (;;) {
+        unsigned k = 0;
+        while (k < n_keys && !key_head[k]) k++;
+        if (k == n_keys) return;
+        struct pollfd p = {done_fd, POLLIN, 0};
+        if (poll(&p, 1, -1) < 0) continue;
+        fd_set rfds;
+        FD_ZERO(&rfds);
+        FD_SET(done_fd, &rfds);
+        filterpool_handle(&rfds, deliver);
+    }
+}
+
+void filterpool_stop(void) {
+    if (n_workers == 0) return;
+    pthread_mutex_lock(&q_lock);
+    stopping = true;
+    pthread_cond_broadcast(&q_cond);
+    pthread_mutex_unlock(&q_lock);
+    for (unsigned t = 0; t < n_workers; ++t) pthread_join(workers[t], NULL);
+    n_workers = 0;
+    filterpool_detach();
+}
+
+void filterpool_detach(void) {
+    if (done_fd >= 0) close(done_fd);
+    done_fd = -1;
+    n_keys = 0;
+}
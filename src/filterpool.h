@@ -0,0 +1,61 @@
+/* filterpool.h
+   Worker threads for the profanity filter. The event loop hands long
+   messages to the pool and keeps routing; finished jobs come back through
+   an eventfd in the loop's select() set and are delivered, per key (a
+   room, say), in the order they were submitted, whichever worker finished
+   first. Everything except the work function runs on the loop's thread.
+*/
+#ifndef FILTERPOOL_H
+#define FILTERPOOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <sys/select.h>
+
+#define FP_MAX_THREADS 16
+
+typedef struct fp_job {
+    struct fp_job *next;     /* pool internal: work queue */
+    struct fp_job *key_next; /* pool internal: per-key order */
+    _Atomic int done;
+    unsigned key;
+    char *text;              /* filtered in place by the work function */
+    size_t len;
+} fp_job_t;
+
+typedef void (*fp_work_fn)(char *text, size_t len);
+typedef void (*fp_deliver_fn)(fp_job_t *job);
+
+/* start threads workers running work; keys are 0..nkeys-1. Returns 0, or
+   -1 if nothing could be started (callers then filter inline). */
+int filterpool_start(unsigned threads, unsigned nkeys, fp_work_fn work);
+
+/* worker threads running (0 when the pool is off) */
+unsigned filterpool_threads(void);
+
+/* jobs for key submitted but not yet delivered; a message for the same
+   key must then go through the pool too, or it would overtake them */
+bool filterpool_pending(unsigned key);
+
+/* queue j (j->key, j->text and j->len set); the caller owns j and gets it
+   back through the deliver callback */
+void filterpool_submit(fp_job_t *j);
+
+/* add the completion eventfd to the select set */
+void filterpool_fds(fd_set *rfds, int *maxfd);
+
+/* if select reported completions, deliver every job whose predecessors
+   for the same key are delivered too */
+void filterpool_handle(fd_set *rfds, fp_deliver_fn deliver);
+
+/* block until every submitted job has been delivered */
+void filterpool_drain(fp_deliver_fn deliver);
+
+/* stop and join the workers; undelivered jobs are abandoned */
+void filterpool_stop(void);
+
+/* drop the eventfd without touching threads (forked children call this) */
+void filterpool_detach(void);
+
+#endif
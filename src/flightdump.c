@@ -0,0 +1,90 @@
+/* flightdump.c
+   Decoder for flight recorder dumps (logs/flight-<pid>.bin).
+   Prints the events oldest first with their time relative to the dump,
+   then the slowest events, which is usually where a stall shows up.
+   Usage: ./flightdump <file> [last-n-events]
+*/
+#include "flightrec.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TOP_N 10
+
+static fr_event_t *events;
+
+static int by_dur_desc(const void *a, const void *b) {
+    uint32_t x = events[*(const uint32_t *)a].dur_ns, y = events[*(const uint32_t *)b].dur_ns;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void print_event(const fr_event_t *e, const fr_header_t *h) {
+    char tag[FR_TAG_LEN + 1];
+    memcpy(tag, e->tag, FR_TAG_LEN);
+    tag[FR_TAG_LEN] = '\0';
+    double rel_ms = ((double)e->ts_ns - (double)h->dump_mono_ns) / 1e6;
+    printf("%12.3f ms  %-10s", rel_ms, flightrec_type_name(e->type));
+    if (e->slot >= 0) printf(" slot=%-3d", e->slot);
+    else printf(" slot=-  ");
+    printf(" arg=%-8u dur=%10.1f us  %s\n", e->arg, e->dur_ns / 1e3, tag);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <flight-file> [last-n-events]\n", argv[0]);
+        return 1;
+    }
+    FILE *f = fopen(argv[1], "rb");
+    if (!f) { perror(argv[1]); return 1; }
+
+    fr_header_t h;
+    if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, FR_MAGIC, 4) != 0) {
+        fprintf(stderr, "%s: not a flight recorder dump\n", argv[1]);
+        return 1;
+    }
+    if (h.version != FR_VERSION || h.event_size != sizeof(fr_event_t) || h.capacity == 0) {
+        fprintf(stderr, "%s: unsupported dump (version %u, event size %u)\n",
+                argv[1], h.version, h.event_size);
+        return 1;
+    }
+    events = calloc(h.capacity, sizeof(*events));
+    if (!events || fread(events, sizeof(*events), h.capacity, f) != h.capacity) {
+        fprintf(stderr, "%s: truncated dump\n", argv[1]);
+        return 1;
+    }
+    fclose(f);
+
+    uint64_t count = h.head < h.capacity ? h.head : h.capacity;
+    uint64_t first = h.head - count; /* oldest event still in the ring */
+    uint64_t show = count;
+    if (argc > 2) {
+        uint64_t n = strtoull(argv[2], NULL, 10);
+        if (n < show) show = n;
+    }
+
+    time_t wall = (time_t)(h.dump_real_ns / 1000000000ull);
+    char when[64];
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&wall));
+    printf("pid %d, signal %d, dumped %s, %llu events recorded, %llu kept\n",
+           h.pid, h.signo, when, (unsigned long long)h.head, (unsigned long long)count);
+
+    for (uint64_t k = h.head - show; k < h.head; ++k)
+        print_event(&events[k % h.capacity], &h);
+
+    /* slowest events still in the ring */
+    uint32_t *order = malloc(sizeof(*order) * (count ? count : 1));
+    if (!order) return 1;
+    for (uint64_t k = 0; k < count; ++k) order[k] = (uint32_t)((first + k) % h.capacity);
+    qsort(order, count, sizeof(*order), by_dur_desc);
+    printf("\nslowest events:\n");
+    for (uint64_t k = 0; k < count && k < TOP_N; ++k) {
+        if (events[order[k]].dur_ns == 0) break;
+        print_event(&events[order[k]], &h);
+    }
+
+    free(order);
+    free(events);
+    return 0;
+}
@@ -0,0 +1,137 @@
+/* flightrec.c
+   Recording is a relaxed fetch_add to claim a slot and a 32-byte store:
+   no locks, no allocation, nothing that can block the loop. The dump path
+   runs in signal context, so it only uses open/write/close and builds the
+   file name by hand.
+*/
+#include "flightrec.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static fr_event_t ring[FR_CAPACITY];
+static _Atomic uint64_t ring_head = 0;
+static char dump_dir[256] = ".";
+
+static const int fatal_signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+#define N_FATAL (sizeof(fatal_signals) / sizeof(fatal_signals[0]))
+
+static const char *type_names[FR_TYPE_COUNT] = {
+    [FR_LOOP] = "loop",
+    [FR_ACCEPT] = "accept",
+    [FR_DISCONNECT] = "disconnect",
+    [FR_FRAME] = "frame",
+    [FR_BROADCAST] = "broadcast",
+    [FR_ROTATE] = "rotate",
+    [FR_SIGNAL] = "signal",
+};
+
+const char *flightrec_type_name(unsigned type) {
+    return type < FR_TYPE_COUNT && type_names[type] ? type_names[type] : "?";
+}
+
+static uint64_t clock_ns(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void flightrec_log(fr_type_t type, int slot, const char *tag, uint32_t arg, uint64_t dur_ns) {
+    uint64_t idx = atomic_fetch_add_explicit(&ring_head, 1, memory_order_relaxed);
+    fr_event_t *e = &ring[idx & (FR_CAPACITY - 1)];
+    e->ts_ns = clock_ns(CLOCK_MONOTONIC);
+    e->dur_ns = dur_ns > UINT32_MAX ? UINT32_MAX : (uint32_t)dur_ns;
+    e->arg = arg;
+    e->slot = (int16_t)slot;
+    e->type = (uint8_t)type;
+    e->pad = 0;
+    if (tag) strncpy(e->tag, tag, FR_TAG_LEN);
+    else memset(e->tag, 0, FR_TAG_LEN);
+}
+
+/* decimal into buf, returns length; for use in signal context */
+static size_t put_uint(char *buf, unsigned long v) {
+    char tmp[24];
+    size_t n = 0;
+    do { tmp[n++] = '0' + v % 10; v /= 10; } while (v);
+    for (size_t k = 0; k < n; ++k) buf[k] = tmp[n - 1 - k];
+    return n;
+}
+
+static int write_all(int fd, const void *p, size_t len) {
+    const char *c = p;
+    while (len) {
+        ssize_t w = write(fd, c, len);
+        if (w < 0) return -1;
+        c += w;
+        len -= w;
+    }
+    return 0;
+}
+
+int flightrec_dump(int signo) {
+    flightrec_log(FR_SIGNAL, -1, NULL, signo, 0);
+
+    char path[320];
+    size_t dl = strlen(dump_dir), o = 0;
+    memcpy(path, dump_dir, dl); o += dl;
+    memcpy(path + o, "/flight-", 8); o += 8;
+    o += put_uint(path + o, (unsigned long)getpid());
+    memcpy(path + o, ".bin", 5);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+    fr_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, FR_MAGIC, 4);
+    h.version = FR_VERSION;
+    h.event_size = sizeof(fr_event_t);
+    h.capacity = FR_CAPACITY;
+    h.head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    h.dump_mono_ns = clock_ns(CLOCK_MONOTONIC);
+    h.dump_real_ns = clock_ns(CLOCK_REALTIME);
+    h.pid = getpid();
+    h.signo = signo;
+    int rc = write_all(fd, &h, sizeof(h)) || write_all(fd, ring, sizeof(ring)) ? -1 : 0;
+    close(fd);
+    return rc;
+}
+
+static void on_signal(int signo) {
+    int saved = errno;
+    flightrec_dump(signo);
+    if (signo != SIGQUIT) {
+        /* die the way we would have without the recorder */
+        signal(signo, SIG_DFL);
+        raise(signo);
+    }
+    errno = saved;
+}
+
+void flightrec_init(const char *dir) {
+    size_t n = strlen(dir);
+    if (n >= sizeof(dump_dir)) n = sizeof(dump_dir) - 1;
+    memcpy(dump_dir, dir, n);
+    dump_dir[n] = '\0';
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGQUIT, &sa, NULL);
+    /* one-shot for fatal signals so a crash inside the dump cannot loop */
+    sa.sa_flags = SA_RESETHAND | SA_NODEFER;
+    for (size_t k = 0; k < N_FATAL; ++k) sigaction(fatal_signals[k], &sa, NULL);
+}
+
+void flightrec_detach(void) {
+    /* a terminal ^\ hits the whole process group; only the parent dumps */
+    signal(SIGQUIT, SIG_IGN);
+    for (size_t k = 0; k < N_FATAL; ++k) signal(fatal_signals[k], SIG_DFL);
+}
@@ -0,0 +1,68 @@
+/* flightrec.h
+   Always-on flight recorder for the parent loop. Every accept, frame,
+   broadcast and loop iteration appends a fixed-size binary event to an
+   in-memory ring; the ring is written to <dir>/flight-<pid>.bin on
+   SIGQUIT (the server keeps running) or on a fatal signal (it then dies
+   as it would have). Decode dumps with ./flightdump.
+*/
+#ifndef FLIGHTREC_H
+#define FLIGHTREC_H
+
+#include <stdint.h>
+
+typedef enum {
+    FR_LOOP = 1,   /* arg: ready fds, dur: work done in the previous iteration */
+    FR_ACCEPT,     /* arg: child pid */
+    FR_DISCONNECT,
+    FR_FRAME,      /* tag: command, dur: dispatch time */
+    FR_BROADCAST,  /* tag: room, arg: recipients, dur: filter + log + fan-out */
+    FR_ROTATE,     /* tag: room whose hot log was rotated */
+    FR_SIGNAL,     /* arg: signal that triggered the dump */
+    FR_TYPE_COUNT
+} fr_type_t;
+
+#define FR_TAG_LEN 12
+
+typedef struct {
+    uint64_t ts_ns;        /* CLOCK_MONOTONIC */
+    uint32_t dur_ns;       /* saturates at ~4.29 s */
+    uint32_t arg;
+    int16_t slot;          /* client slot, -1 if none */
+    uint8_t type;          /* fr_type_t */
+    uint8_t pad;
+    char tag[FR_TAG_LEN];  /* NUL padded, not necessarily terminated */
+} fr_event_t;
+
+#define FR_MAGIC "CHFR"
+#define FR_VERSION 1
+#define FR_CAPACITY 65536 /* events, power of two */
+
+/* dump file: this header, then FR_CAPACITY events in ring order;
+   slot (head % capacity) holds the oldest event once the ring wrapped */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t event_size;
+    uint32_t capacity;
+    uint64_t head;         /* events ever recorded */
+    uint64_t dump_mono_ns; /* CLOCK_MONOTONIC at dump time */
+    uint64_t dump_real_ns; /* CLOCK_REALTIME at dump time */
+    int32_t pid;
+    int32_t signo;
+} fr_header_t;
+
+/* install SIGQUIT and fatal signal handlers; dumps go to dir */
+void flightrec_init(const char *dir);
+
+/* forked connection children keep a stale copy of the ring: they ignore
+   SIGQUIT and get the default fatal signal dispositions back */
+void flightrec_detach(void);
+
+void flightrec_log(fr_type_t type, int slot, const char *tag, uint32_t arg, uint64_t dur_ns);
+
+/* write the ring out (async-signal-safe); returns 0 on success */
+int flightrec_dump(int signo);
+
+const char *flightrec_type_name(unsigned type);
+
+#endif
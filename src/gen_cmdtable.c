@@ -0,0 +1,82 @@
+/* gen_cmdtable.c
+   Build-time generator: reads commands.def (through the CMD X-macro) and
+   writes cmd_table.h with a collision-free multiplicative hash per layer.
+   Tables are kept at least twice the command count so seeds are found in
+   a handful of tries; the build fails loudly if a layer cannot be hashed.
+   Usage: ./gen_cmdtable > src/cmd_table.h
+*/
+#include "commands.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    cmd_layer_t layer;
+    const char *id;
+    const char *name;
+} entry_t;
+
+static const entry_t entries[] = {
+#define CMD(layer, id, name, args) {CMD_LAYER_##layer, #id, name},
+#include "commands.def"
+#undef CMD
+};
+#define N_ENTRIES (sizeof(entries) / sizeof(entries[0]))
+
+static const char *layer_names[CMD_LAYER_COUNT] = {"frame", "admin", "slash", "bus", "peer"};
+static const char *layer_macros[CMD_LAYER_COUNT] = {"FRAME", "ADMIN", "SLASH", "BUS", "PEER"};
+
+/* returns 1 and fills seed/bits when the layer hashes without collisions */
+static int find_seed(cmd_layer_t layer, uint32_t *seed, unsigned *bits) {
+    size_t n = 0;
+    for (size_t k = 0; k < N_ENTRIES; ++k) n += entries[k].layer == layer;
+    unsigned b = 1;
+    while ((1u << b) < 2 * n) ++b;
+    for (; b <= 12; ++b) {
+        uint32_t s = 0x9e3779b1u;
+        for (int attempt = 0; attempt < 100000; ++attempt) {
+            s = s * 1664525u + 1013904223u;
+            uint32_t cand = s | 1;
+            unsigned char used[1 << 12] = {0};
+            int ok = 1;
+            for (size_t k = 0; k < N_ENTRIES && ok; ++k) {
+                if (entries[k].layer != layer) continue;
+                const char *nm = entries[k].name;
+                uint32_t h = cmd_hash(nm, strlen(nm), cand, b);
+                if (used[h]) ok = 0;
+                used[h] = 1;
+            }
+            if (ok) { *seed = cand; *bits = b; return 1; }
+        }
+    }
+    return 0;
+}
+
+int main(void) {
+    printf("/* cmd_table.h: generated by gen_cmdtable from commands.def, do not edit */\n");
+    for (int l = 0; l < CMD_LAYER_COUNT; ++l) {
+        uint32_t seed;
+        unsigned bits;
+        if (!find_seed(l, &seed, &bits)) {
+            fprintf(stderr, "gen_cmdtable: no perfect hash for the %s layer\n", layer_names[l]);
+            return 1;
+        }
+        printf("\n#define CMD_%s_SEED 0x%08xu\n#define CMD_%s_BITS %u\n",
+               layer_macros[l], seed, layer_macros[l], bits);
+        printf("static const cmd_slot_t cmd_%s_slots[%u] = {\n", layer_names[l], 1u << bits);
+        for (size_t k = 0; k < N_ENTRIES; ++k) {
+            if (entries[k].layer != (cmd_layer_t)l) continue;
+            const char *nm = entries[k].name;
+            printf("    [%u] = {\"%s\", %zu, %s},\n",
+                   cmd_hash(nm, strlen(nm), seed, bits), nm, strlen(nm), entries[k].id);
+        }
+        printf("};\n");
+    }
+    printf("\nstatic const cmd_layer_table_t cmd_tables[CMD_LAYER_COUNT] = {\n");
+    for (int l = 0; l < CMD_LAYER_COUNT; ++l)
+        printf("    {CMD_%s_SEED, CMD_%s_BITS, cmd_%s_slots},\n",
+               layer_macros[l], layer_macros[l], layer_names[l]);
+    printf("};\n");
+    return 0;
+}
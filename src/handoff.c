@@ -0,0 +1,213 @@
+/* handoff.c
+   Records are a fixed header followed by the payload on a stream socket.
+   The header is sent with sendmsg() so any descriptors are attached to
+   its first byte, and read back with recvmsg() for exactly the header
+   size, so the fds are never split from their record.
+*/
+#define _GNU_SOURCE
+#include "handoff.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define HO_MAGIC 0x46464f48u /* "HOFF" */
+#define HO_MAX_RECORD (64u << 20)
+
+typedef struct {
+    uint32_t magic, type, len, nfds;
+} ho_header_t;
+
+static int make_addr(const char *path, struct sockaddr_un *sa) {
+    memset(sa, 0, sizeof(*sa));
+    sa->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(sa->sun_path)) { errno = ENAMETOOLONG; return -1; }
+    strcpy(sa->sun_path, path);
+    return 0;
+}
+
+int handoff_listen(const char *path) {
+    struct sockaddr_un sa;
+    if (make_addr(path, &sa) < 0) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(fd, 1) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int handoff_connect(const char *path) {
+    struct sockaddr_un sa;
+    if (make_addr(path, &sa) < 0) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int write_all(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        n -= w;
+    }
+    return 0;
+}
+
+static int read_all(int fd, char *p, size_t n) {
+    while (n > 0) {
+        ssize_t r = read(fd, p, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        p += r;
+        n -= r;
+    }
+    return 0;
+}
+
+int handoff_send(int sock, uint32_t type, const void *data, size_t len, const int *fds, int nfds) {
+    if (nfds < 0 || nfds > HO_MAX_FDS || len > HO_MAX_RECORD) return -1;
+    ho_header_t h = {HO_MAGIC, type, (uint32_t)len, (uint32_t)nfds};
+    struct iovec iov = {&h, sizeof(h)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HO_MAX_FDS)];
+        struct cmsghdr align;
+    } ctl;
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (nfds > 0) {
+        msg.msg_control = ctl.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cm), fds, sizeof(int) * nfds);
+    }
+    ssize_t w;
+    do w = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    while (w < 0 && errno == EINTR);
+    if (w < 0) return -1;
+    /* a short header write leaves the rest as plain bytes */
+    if (write_all(sock, (const char *)&h + w, sizeof(h) - w) < 0) return -1;
+    return write_all(sock, data, len);
+}
+
+int handoff_recv(int sock, uint32_t *type, void **data, size_t *len, int *fds, int *nfds) {
+    ho_header_t h;
+    struct iovec iov = {&h, sizeof(h)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HO_MAX_FDS)];
+        struct cmsghdr align;
+    } ctl;
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    ssize_t r;
+    do r = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    while (r < 0 && errno == EINTR);
+    if (r <= 0) return -1;
+
+    *nfds = 0;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+        int n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int k = 0; k < n; ++k) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cm) + k * sizeof(int), sizeof(int));
+            if (*nfds < HO_MAX_FDS) fds[(*nfds)++] = fd;
+            else close(fd);
+        }
+    }
+    if (read_all(sock, (char *)&h + r, sizeof(h) - r) < 0 || h.magic != HO_MAGIC ||
+        h.len > HO_MAX_RECORD || h.nfds != (uint32_t)*nfds)
+        goto bad;
+    char *p = malloc(h.len + 1);
+    if (!p) goto bad;
+    if (read_all(sock, p, h.len) < 0) {
+        free(p);
+        goto bad;
+    }
+    p[h.len] = '\0';
+    *type = h.type;
+    *data = p;
+    *len = h.len;
+    return 0;
+bad:
+    for (int k = 0; k < *nfds; ++k) close(fds[k]);
+    *nfds = 0;
+    return -1;
+}
+
+/* ------------ PACKER ------------ */
+static void put(ho_buf_t *b, const void *p, size_t n) {
+    if (b->bad || n == 0) return;
+    if (b->len + n > b->cap) {
+        size_t cap = b->cap ? b->cap : 256;
+        while (cap < b->len + n) cap *= 2;
+        char *nb = realloc(b->buf, cap);
+        if (!nb) { b->bad = true; return; }
+        b->buf = nb;
+        b->cap = cap;
+    }
+    memcpy(b->buf + b->len, p, n);
+    b->len += n;
+}
+
+void ho_put_u64(ho_buf_t *b, uint64_t v) {
+    put(b, &v, sizeof(v));
+}
+
+void ho_put_bytes(ho_buf_t *b, const void *p, size_t n) {
+    ho_put_u64(b, n);
+    put(b, p, n);
+}
+
+void ho_put_str(ho_buf_t *b, const char *s) {
+    ho_put_bytes(b, s ? s : "", s ? strlen(s) + 1 : 1);
+}
+
+uint64_t ho_get_u64(ho_buf_t *b) {
+    uint64_t v = 0;
+    if (b->bad || b->len - b->off < sizeof(v)) { b->bad = true; return 0; }
+    memcpy(&v, b->buf + b->off, sizeof(v));
+    b->off += sizeof(v);
+    return v;
+}
+
+const void *ho_get_bytes(ho_buf_t *b, size_t *n) {
+    uint64_t len = ho_get_u64(b);
+    if (b->bad || b->len - b->off < len) { b->bad = true; *n = 0; return NULL; }
+    const void *p = b->buf + b->off;
+    b->off += len;
+    *n = len;
+    return p;
+}
+
+const char *ho_get_str(ho_buf_t *b) {
+    size_t n;
+    const char *s = ho_get_bytes(b, &n);
+    if (!s || n == 0 || s[n - 1] != '\0') { b->bad = true; return ""; }
+    return s;
+}
+
+void ho_free(ho_buf_t *b) {
+    free(b->buf);
+    memset(b, 0, sizeof(*b));
+}
@@ -0,0 +1,49 @@
+/* handoff.h
+   Transport for hot restarts: a new server connects to the running one
+   over a UNIX stream socket and receives typed records, each optionally
+   carrying file descriptors (SCM_RIGHTS). Record payloads are built with
+   the ho_buf_t packer, which is length-checked on the way back out.
+*/
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define HO_MAX_FDS 8
+
+/* listen on path (replacing a stale socket file); returns the fd or -1 */
+int handoff_listen(const char *path);
+
+/* connect to a server listening on path; -1 if nobody is there */
+int handoff_connect(const char *path);
+
+/* one record; fds travel with its header */
+int handoff_send(int sock, uint32_t type, const void *data, size_t len, const int *fds, int nfds);
+
+/* next record: *data is malloc'd (free it), *nfds fds are stored in fds.
+   Returns 0, or -1 on EOF, timeout or a malformed record. */
+int handoff_recv(int sock, uint32_t *type, void **data, size_t *len, int *fds, int *nfds);
+
+/* ------------ PACKER ------------ */
+typedef struct {
+    char *buf;
+    size_t len, cap; /* writing */
+    size_t off;      /* reading */
+    bool bad;        /* out of memory, or read past the end */
+} ho_buf_t;
+
+void ho_put_u64(ho_buf_t *b, uint64_t v);
+void ho_put_bytes(ho_buf_t *b, const void *p, size_t n);
+void ho_put_str(ho_buf_t *b, const char *s);
+
+uint64_t ho_get_u64(ho_buf_t *b);
+/* pointer into the buffer, NULL (and b->bad) if truncated */
+const void *ho_get_bytes(ho_buf_t *b, size_t *n);
+/* "" if the field is missing or not NUL-terminated (and b->bad) */
+const char *ho_get_str(ho_buf_t *b);
+
+void ho_free(ho_buf_t *b);
+
+#endif
@@ -0,0 +1,183 @@
+/* httpd.c
+   Tiny scrape endpoint. Connections are non-blocking, a request is read
+   until the end of its headers, rendered once into a heap buffer and
+   written out as the socket accepts it. Idle or slow peers are dropped
+   after HTTPD_TIMEOUT seconds so they cannot pin slots.
+*/
+#define _GNU_SOURCE
+#include "httpd.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HTTPD_MAX_CONNS 8
+#define HTTPD_REQ_MAX 2048
+#define HTTPD_BODY_START (256 * 1024) /* grown when a render needs more */
+#define HTTPD_TIMEOUT 5
+
+typedef struct {
+    int fd;            /* -1 when free */
+    time_t started;
+    char req[HTTPD_REQ_MAX];
+    size_t req_len;
+    char *resp;        /* NULL until the request is complete */
+    size_t resp_len, resp_off;
+} http_conn_t;
+
+static int http_listen_fd = -1;
+static httpd_render_fn http_render;
+static http_conn_t http_conns[HTTPD_MAX_CONNS];
+
+int httpd_open(const char *spec, httpd_render_fn render) {
+    int fd;
+    if (strchr(spec, '/')) {
+        struct sockaddr_un sun = {0};
+        sun.sun_family = AF_UNIX;
+        if (strlen(spec) >= sizeof(sun.sun_path)) return -1;
+        strcpy(sun.sun_path, spec);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        unlink(spec);
+        if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) { close(fd); return -1; }
+    } else {
+        char host[64] = "127.0.0.1";
+        const char *port = spec;
+        const char *colon = strrchr(spec, ':');
+        if (colon) {
+            size_t hl = colon - spec;
+            if (hl >= sizeof(host)) return -1;
+            memcpy(host, spec, hl);
+            host[hl] = '\0';
+            port = colon + 1;
+        }
+        struct sockaddr_in sin = {0};
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons(atoi(port));
+        if (inet_pton(AF_INET, host, &sin.sin_addr) <= 0) return -1;
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        int opt = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) { close(fd); return -1; }
+    }
+    if (listen(fd, 16) < 0) { close(fd); return -1; }
+
+    for (int i = 0; i < HTTPD_MAX_CONNS; ++i) http_conns[i].fd = -1;
+    http_listen_fd = fd;
+    http_render = render;
+    return 0;
+}
+
+static void conn_close(http_conn_t *c) {
+    close(c->fd);
+    free(c->resp);
+    c->fd = -1;
+    c->resp = NULL;
+}
+
+void httpd_close(void) {
+    if (http_listen_fd < 0) return;
+    for (int i = 0; i < HTTPD_MAX_CONNS; ++i)
+        if (http_conns[i].fd >= 0) conn_close(&http_conns[i]);
+    close(http_listen_fd);
+    http_listen_fd = -1;
+}
+
+void httpd_fds(fd_set *rfds, fd_set *wfds, int *maxfd) {
+    if (http_listen_fd < 0) return;
+    FD_SET(http_listen_fd, rfds);
+    if (http_listen_fd > *maxfd) *maxfd = http_listen_fd;
+    time_t now = time(NULL);
+    for (int i = 0; i < HTTPD_MAX_CONNS; ++i) {
+        http_conn_t *c = &http_conns[i];
+        if (c->fd < 0) continue;
+        if (now - c->started > HTTPD_TIMEOUT) { conn_close(c); continue; }
+        FD_SET(c->fd, c->resp ? wfds : rfds);
+        if (c->fd > *maxfd) *maxfd = c->fd;
+    }
+}
+
+static void build_response(http_conn_t *c) {
+    char path[256] = "/";
+    sscanf(c->req, "GET %255s", path);
+    size_t cap = HTTPD_BODY_START;
+    char *body = malloc(cap);
+    size_t n = body ? http_render(path, body, cap) : (size_t)-1;
+    while (n != (size_t)-1 && n >= cap) {
+        /* cut short: render again into as much as it asked for */
+        char *bigger = realloc(body, n + 1);
+        if (!bigger) { free(body); conn_close(c); return; }
+        body = bigger;
+        cap = n + 1;
+        n = http_render(path, body, cap);
+    }
+    const char *status = "200 OK";
+    if (strncmp(c->req, "GET ", 4) != 0) { status = "405 Method Not Allowed"; n = 0; }
+    else if (n == (size_t)-1) { status = "404 Not Found"; n = 0; }
+
+    char hdr[256];
+    int hl = snprintf(hdr, sizeof(hdr),
+                      "HTTP/1.0 %s\r\n"
+                      "Content-Type: text/plain; version=0.0.4\r\n"
+                      "Content-Length: %zu\r\n"
+                      "Connection: close\r\n\r\n", status, n);
+    c->resp = malloc(hl + n);
+    if (!c->resp) { free(body); conn_close(c); return; }
+    memcpy(c->resp, hdr, hl);
+    if (n) memcpy(c->resp + hl, body, n);
+    c->resp_len = hl + n;
+    c->resp_off = 0;
+    free(body);
+}
+
+void httpd_handle(fd_set *rfds, fd_set *wfds) {
+    if (http_listen_fd < 0) return;
+
+    if (FD_ISSET(http_listen_fd, rfds)) {
+        int fd;
+        while ((fd = accept4(http_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+            http_conn_t *slot = NULL;
+            for (int i = 0; i < HTTPD_MAX_CONNS && !slot; ++i)
+                if (http_conns[i].fd < 0) slot = &http_conns[i];
+            if (!slot) { close(fd); continue; }
+            slot->fd = fd;
+            slot->started = time(NULL);
+            slot->req_len = 0;
+            slot->resp = NULL;
+        }
+    }
+
+    for (int i = 0; i < HTTPD_MAX_CONNS; ++i) {
+        http_conn_t *c = &http_conns[i];
+        if (c->fd < 0) continue;
+
+        if (!c->resp && FD_ISSET(c->fd, rfds)) {
+            ssize_t n = read(c->fd, c->req + c->req_len, sizeof(c->req) - 1 - c->req_len);
+            if (n <= 0) {
+                if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+                conn_close(c);
+                continue;
+            }
+            c->req_len += n;
+            c->req[c->req_len] = '\0';
+            if (strstr(c->req, "\r\n\r\n") || strstr(c->req, "\n\n") ||
+                c->req_len == sizeof(c->req) - 1)
+                build_response(c);
+        } else if (c->resp && FD_ISSET(c->fd, wfds)) {
+            ssize_t w = write(c->fd, c->resp + c->resp_off, c->resp_len - c->resp_off);
+            if (w < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+            if (w <= 0) { conn_close(c); continue; }
+            c->resp_off += w;
+            if (c->resp_off == c->resp_len) conn_close(c);
+        }
+    }
+}
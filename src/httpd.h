@@ -0,0 +1,30 @@
+/* httpd.h
+   Minimal non-blocking HTTP/1.0 responder driven by the server's select()
+   loop. It answers every GET with the body produced by a render callback,
+   which is all a metrics scraper needs.
+*/
+#ifndef HTTPD_H
+#define HTTPD_H
+
+#include <stddef.h>
+#include <sys/select.h>
+
+/* fill buf (cap bytes) with the response body for path; return its length.
+   A length of cap or more means the body did not fit and asks for a buffer
+   that big, as snprintf does. Return (size_t)-1 for 404. */
+typedef size_t (*httpd_render_fn)(const char *path, char *buf, size_t cap);
+
+/* listen on "port", "host:port" (TCP, host defaults to 127.0.0.1) or a
+   UNIX socket path (anything containing '/'). Returns 0 on success. */
+int httpd_open(const char *spec, httpd_render_fn render);
+
+/* add the listener and connections to the select sets */
+void httpd_fds(fd_set *rfds, fd_set *wfds, int *maxfd);
+
+/* service whatever select reported */
+void httpd_handle(fd_set *rfds, fd_set *wfds);
+
+/* drop the listener and connections (forked children call this) */
+void httpd_close(void);
+
+#endif
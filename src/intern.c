@@ -0,0 +1,169 @@
+/* intern.c
+   Intern table sized once at startup: atoms[] holds the strings, table[]
+   is an open addressing index (linear probing) that stores each atom's
+   hash next to its id so probes rarely touch the string itself.
+*/
+#include "intern.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SLOT_EMPTY 0
+#define SLOT_TOMB UINT32_MAX
+
+typedef struct {
+    uint32_t hash;
+    uint32_t refs;
+    uint8_t len;
+    char str[ATOM_MAX_LEN + 1];
+} atom_entry_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t hash;
+} slot_t;
+
+static atom_entry_t *atoms;
+static slot_t *table;
+static uint32_t *free_ids;
+static uint32_t max_atoms = 0;  /* ids 1..max_atoms-1 */
+static size_t table_size = 0;   /* power of two, load <= 1/2 */
+static unsigned free_count = 0;
+static uint32_t next_id = 1;
+static unsigned live = 0;
+static unsigned tombs = 0;
+
+static uint32_t hash_name(const char *s, size_t len) {
+    uint32_t h = 2166136261u; /* FNV-1a */
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static size_t name_len(const char *s) {
+    size_t n = 0;
+    while (n < ATOM_MAX_LEN && s[n]) n++;
+    return n;
+}
+
+/* index of the slot holding the name, or -1 */
+static long find_slot(const char *s, size_t len, uint32_t h) {
+    for (size_t i = h & (table_size - 1);; i = (i + 1) & (table_size - 1)) {
+        slot_t *sl = &table[i];
+        if (sl->id == SLOT_EMPTY) return -1;
+        if (sl->id != SLOT_TOMB && sl->hash == h) {
+            atom_entry_t *e = &atoms[sl->id];
+            if (e->len == len && memcmp(e->str, s, len) == 0) return (long)i;
+        }
+    }
+}
+
+static void insert_slot(uint32_t id, uint32_t h) {
+    size_t i = h & (table_size - 1);
+    while (table[i].id != SLOT_EMPTY && table[i].id != SLOT_TOMB)
+        i = (i + 1) & (table_size - 1);
+    if (table[i].id == SLOT_TOMB) tombs--;
+    table[i].id = id;
+    table[i].hash = h;
+}
+
+/* drop tombstones once they start lengthening probe chains */
+static void rebuild(void) {
+    memset(table, 0, table_size * sizeof(*table));
+    tombs = 0;
+    for (uint32_t id = 1; id < next_id; ++id)
+        if (atoms[id].refs > 0) insert_slot(id, atoms[id].hash);
+}
+
+int intern_init(unsigned capacity) {
+    if (atoms) return 0;
+    uint32_t n = capacity + 1; /* id 0 is ATOM_NONE */
+    size_t size = 2;
+    while (size < 2 * (size_t)n) size *= 2;
+    atoms = calloc(n, sizeof(*atoms));
+    free_ids = calloc(n, sizeof(*free_ids));
+    table = calloc(size, sizeof(*table));
+    if (!atoms || !free_ids || !table) {
+        free(atoms);
+        free(free_ids);
+        free(table);
+        atoms = NULL;
+        return -1;
+    }
+    max_atoms = n;
+    table_size = size;
+    return 0;
+}
+
+atom_t intern_lookup(const char *s) {
+    if (!s || !s[0] || !atoms) return ATOM_NONE;
+    size_t len = name_len(s);
+    long i = find_slot(s, len, hash_name(s, len));
+    return i < 0 ? ATOM_NONE : table[i].id;
+}
+
+atom_t intern(const char *s) {
+    if (!s || !s[0] || !atoms) return ATOM_NONE;
+    size_t len = name_len(s);
+    uint32_t h = hash_name(s, len);
+    long i = find_slot(s, len, h);
+    if (i >= 0) {
+        atoms[table[i].id].refs++;
+        return table[i].id;
+    }
+
+    uint32_t id;
+    if (free_count > 0) id = free_ids[--free_count];
+    else if (next_id < max_atoms) id = next_id++;
+    else return ATOM_NONE;
+
+    atom_entry_t *e = &atoms[id];
+    memcpy(e->str, s, len);
+    e->str[len] = '\0';
+    e->len = (uint8_t)len;
+    e->hash = h;
+    e->refs = 1;
+    insert_slot(id, h);
+    live++;
+    return id;
+}
+
+void atom_ref(atom_t a) {
+    if (a != ATOM_NONE) atoms[a].refs++;
+}
+
+void atom_unref(atom_t a) {
+    if (a == ATOM_NONE || atoms[a].refs == 0) return;
+    if (--atoms[a].refs > 0) return;
+
+    atom_entry_t *e = &atoms[a];
+    long i = find_slot(e->str, e->len, e->hash);
+    if (i >= 0) {
+        table[i].id = SLOT_TOMB;
+        tombs++;
+    }
+    e->str[0] = '\0';
+    e->len = 0;
+    free_ids[free_count++] = a;
+    live--;
+    if (tombs > table_size / 4) rebuild();
+}
+
+const char *atom_str(atom_t a) {
+    return a == ATOM_NONE ? "" : atoms[a].str;
+}
+
+uint32_t atom_hash(atom_t a) {
+    return atoms[a].hash;
+}
+
+unsigned atom_count(void) {
+    return live;
+}
+
+unsigned atom_capacity(void) {
+    return max_atoms ? max_atoms - 1 : 0;
+}
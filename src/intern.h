@@ -0,0 +1,38 @@
+/* intern.h
+   String interning for room names and usernames. Each distinct name maps
+   to a small integer atom with a precomputed hash, so the server can
+   compare names with integer equality. Atoms are reference counted and
+   their ids are recycled once the last reference goes away.
+*/
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stdint.h>
+
+typedef uint32_t atom_t;
+
+#define ATOM_NONE 0
+#define ATOM_MAX_LEN 63 /* longer names are truncated, as before */
+
+/* size the table for capacity distinct names; call once before interning.
+   Returns -1 if it cannot be allocated. */
+int intern_init(unsigned capacity);
+
+/* intern s and take a reference; ATOM_NONE for NULL/empty or a full table */
+atom_t intern(const char *s);
+
+/* find s without taking a reference; ATOM_NONE if it was never interned */
+atom_t intern_lookup(const char *s);
+
+void atom_ref(atom_t a);
+void atom_unref(atom_t a);
+
+/* "" for ATOM_NONE */
+const char *atom_str(atom_t a);
+uint32_t atom_hash(atom_t a);
+
+/* number of live atoms, and how many the table can hold */
+unsigned atom_count(void);
+unsigned atom_capacity(void);
+
+#endif
@@ -0,0 +1,39 @@
+/* keepalive.c
+   The held-back bytes always start a line, so they go in front of the new
+   read and the whole buffer is scanned as if it had arrived at once.
+*/
+#include "keepalive.h"
+
+#include <string.h>
+#include <unistd.h>
+
+size_t ping_filter(ping_state_t *st, int sock, const char *in, size_t n, char *out) {
+    const size_t ping_len = sizeof(PING_LINE) - 1;
+    memcpy(out, st->held, st->held_len);
+    memcpy(out + st->held_len, in, n);
+    size_t len = st->held_len + n, r = 0, w = 0;
+    bool line_start = !st->mid_line;
+    st->held_len = 0;
+    while (r < len) {
+        if (line_start) {
+            size_t rest = len - r;
+            if (rest >= ping_len && memcmp(out + r, PING_LINE, ping_len) == 0) {
+                /* a dead socket shows up on the caller's next read */
+                if (sock >= 0 && write(sock, "/pong\n", 6) < 0) sock = -1;
+                r += ping_len;
+                continue;
+            }
+            if (rest < ping_len && memcmp(out + r, PING_LINE, rest) == 0) {
+                memcpy(st->held, out + r, rest);
+                st->held_len = rest;
+                break;
+            }
+        }
+        char c = out[r++];
+        out[w++] = c;
+        line_start = c == '\n';
+    }
+    st->mid_line = !line_start;
+    out[w] = '\0';
+    return w;
+}
@@ -0,0 +1,28 @@
+/* keepalive.h
+   Client side of the server's keepalive, shared by client and
+   admin_client: a line reading exactly "PING" is answered with "/pong"
+   and dropped from what the user sees. A read can end anywhere in a
+   line, so a line start that may still turn into "PING" is held back
+   until the next read decides it.
+*/
+#ifndef KEEPALIVE_H
+#define KEEPALIVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define PING_LINE "PING\n"
+#define PING_HOLD (sizeof(PING_LINE) - 2) /* most bytes ever held back */
+
+typedef struct {
+    char held[PING_HOLD];
+    size_t held_len;
+    bool mid_line; /* the last byte passed on was not '\n' */
+} ping_state_t;
+
+/* Take n bytes read from sock and write what should be shown to out,
+   which needs room for n + PING_HOLD + 1 bytes; answers every complete
+   PING line on sock. Returns the length of out, which is '\0'-terminated. */
+size_t ping_filter(ping_state_t *st, int sock, const char *in, size_t n, char *out);
+
+#endif
@@ -0,0 +1,563 @@
+/* logstore.c
+   Hot/cold room log storage.
+
+   Segment file layout (all integers little endian):
+     header   "CSEG" u32 version u32 block_size
+     blocks   u32 raw_len u32 comp_len bytes[comp_len]
+              (comp_len == raw_len means the block is stored raw)
+     index    per block: u64 offset u32 raw_len u32 comp_len u32 lines
+              (version 1 has no line count)
+     trailer  u64 index_offset u32 block_count "CSEG"
+
+   Blocks are cut on line boundaries so every decoded block holds whole
+   lines and can be served on its own. The line counts let a reader going
+   backwards (logstore_tail) step over blocks without decoding them.
+*/
+#define _GNU_SOURCE
+#include "logstore.h"
+#include "lz.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SEG_MAGIC "CSEG"
+#define SEG_VERSION 2
+#define SEG_HEADER_SIZE 12
+#define SEG_TRAILER_SIZE 16
+#define SEG_INDEX_ENTRY 20
+#define SEG_INDEX_ENTRY_V1 16
+#define SEG_MAX_BLOCK (1 << 20)
+
+/* ------------ HELPERS ------------ */
+static void put32(unsigned char *p, uint32_t v) {
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static uint32_t get32(const unsigned char *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put64(unsigned char *p, uint64_t v) {
+    put32(p, (uint32_t)v);
+    put32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint64_t get64(const unsigned char *p) {
+    return get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int write_all(int fd, const void *buf, size_t n) {
+    const char *p = buf;
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w <= 0) return -1;
+        p += w;
+        n -= w;
+    }
+    return 0;
+}
+
+/* read a whole file into a malloc'd buffer */
+static char *slurp(const char *path, size_t *len) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0) { close(fd); return NULL; }
+    char *buf = malloc(st.st_size ? st.st_size : 1);
+    if (!buf) { close(fd); return NULL; }
+    size_t got = 0;
+    while (got < (size_t)st.st_size) {
+        ssize_t n = read(fd, buf + got, st.st_size - got);
+        if (n <= 0) break;
+        got += n;
+    }
+    close(fd);
+    *len = got;
+    return buf;
+}
+
+static void seg_path(char *out, size_t sz, const char *dir, const char *room, int seq, const char *ext) {
+    snprintf(out, sz, "%s/%s.%d.%s", dir, room, seq, ext);
+}
+
+static int file_exists(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0;
+}
+
+static uint32_t count_lines(const char *p, size_t n) {
+    uint32_t lines = 0;
+    for (const char *end = p + n; (p = memchr(p, '\n', end - p)); ++p) lines++;
+    return lines;
+}
+
+/* ------------ WRITER ------------ */
+int logstore_compress_file(const char *src, const char *dst) {
+    size_t n = 0;
+    char *raw = slurp(src, &n);
+    if (!raw) return -1;
+
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", dst);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { free(raw); return -1; }
+
+    size_t max_blocks = n / (LOG_BLOCK_SIZE / 2) + 2;
+    unsigned char *index = malloc(max_blocks * SEG_INDEX_ENTRY);
+    unsigned char *cbuf = malloc(LZ_BOUND(SEG_MAX_BLOCK));
+    unsigned char hdr[SEG_HEADER_SIZE];
+    memcpy(hdr, SEG_MAGIC, 4);
+    put32(hdr + 4, SEG_VERSION);
+    put32(hdr + 8, LOG_BLOCK_SIZE);
+    int rc = (index && cbuf) ? write_all(fd, hdr, sizeof(hdr)) : -1;
+
+    uint64_t off = SEG_HEADER_SIZE;
+    uint32_t count = 0;
+    size_t pos = 0;
+    while (rc == 0 && pos < n) {
+        /* cut at the last newline that fits, or the first one after it */
+        size_t len = n - pos;
+        if (len > LOG_BLOCK_SIZE) {
+            const char *nl = memrchr(raw + pos, '\n', LOG_BLOCK_SIZE);
+            if (!nl) nl = memchr(raw + pos + LOG_BLOCK_SIZE, '\n', len - LOG_BLOCK_SIZE);
+            len = nl ? (size_t)(nl - (raw + pos)) + 1 : len;
+            if (len > SEG_MAX_BLOCK) len = SEG_MAX_BLOCK;
+        }
+        if (count == max_blocks) { rc = -1; break; }
+
+        size_t clen = lz_compress((unsigned char *)raw + pos, len, cbuf, LZ_BOUND(SEG_MAX_BLOCK));
+        const unsigned char *payload = cbuf;
+        if (clen == 0 || clen >= len) { clen = len; payload = (unsigned char *)raw + pos; }
+
+        unsigned char bh[8];
+        put32(bh, len);
+        put32(bh + 4, clen);
+        unsigned char *e = index + (size_t)count * SEG_INDEX_ENTRY;
+        put64(e, off);
+        put32(e + 8, len);
+        put32(e + 12, clen);
+        put32(e + 16, count_lines(raw + pos, len));
+        rc = write_all(fd, bh, sizeof(bh));
+        if (rc == 0) rc = write_all(fd, payload, clen);
+        off += sizeof(bh) + clen;
+        pos += len;
+        count++;
+    }
+
+    if (rc == 0) rc = write_all(fd, index, (size_t)count * SEG_INDEX_ENTRY);
+    if (rc == 0) {
+        unsigned char tr[SEG_TRAILER_SIZE];
+        put64(tr, off);
+        put32(tr + 8, count);
+        memcpy(tr + 12, SEG_MAGIC, 4);
+        rc = write_all(fd, tr, sizeof(tr));
+    }
+    if (rc == 0) rc = fsync(fd);
+    close(fd);
+    free(index);
+    free(cbuf);
+    free(raw);
+
+    if (rc == 0) rc = rename(tmp, dst);
+    if (rc != 0) { unlink(tmp); return -1; }
+    printf("Compressed %s: %zu -> %llu bytes (%.2fx)\n", dst, n,
+           (unsigned long long)off, off ? (double)n / off : 0.0);
+    return 0;
+}
+
+int logstore_rotate(const char *dir, const char *room) {
+    char hot[256], roll[256], seg[256];
+    snprintf(hot, sizeof(hot), "%s/%s.log", dir, room);
+
+    int seq = 0;
+    for (;; ++seq) {
+        seg_path(seg, sizeof(seg), dir, room, seq, "seg");
+        seg_path(roll, sizeof(roll), dir, room, seq, "roll");
+        if (!file_exists(seg) && !file_exists(roll)) break;
+    }
+    if (rename(hot, roll) < 0) return -1;
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) return -1; /* .roll stays readable; compressed on next rotate */
+    if (pid == 0) {
+        if (logstore_compress_file(roll, seg) == 0) unlink(roll);
+        fflush(stdout);
+        _exit(0);
+    }
+    return pid;
+}
+
+/* ------------ BLOCK CACHE ------------ */
+/* Decoded blocks keyed by (segment inode, block offset). Segments are
+   immutable once renamed into place, so entries never go stale. The cache
+   is set-associative with LRU inside each set, which bounds the resident
+   footprint to BCACHE_SETS * BCACHE_WAYS * LOG_BLOCK_SIZE bytes. */
+#define BCACHE_SETS 16
+#define BCACHE_WAYS 4
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    uint64_t off;
+    uint32_t len;
+    uint64_t used; /* 0 = empty */
+    char data[LOG_BLOCK_SIZE];
+} bcache_entry_t;
+
+static bcache_entry_t *bcache;
+static uint64_t bcache_tick;
+
+static bcache_entry_t *bcache_set(dev_t dev, ino_t ino, uint64_t off) {
+    if (!bcache) {
+        bcache = calloc(BCACHE_SETS * BCACHE_WAYS, sizeof(*bcache));
+        if (!bcache) return NULL;
+    }
+    uint64_t h = ((uint64_t)ino * 0x9E3779B97F4A7C15ull) ^ (off * 0xC2B2AE3D27D4EB4Full) ^ dev;
+    return bcache + (h >> 59 & (BCACHE_SETS - 1)) * BCACHE_WAYS;
+}
+
+static bcache_entry_t *bcache_get(dev_t dev, ino_t ino, uint64_t off) {
+    bcache_entry_t *set = bcache_set(dev, ino, off);
+    if (!set) return NULL;
+    for (int w = 0; w < BCACHE_WAYS; ++w) {
+        if (set[w].used && set[w].ino == ino && set[w].dev == dev && set[w].off == off) {
+            set[w].used = ++bcache_tick;
+            return &set[w];
+        }
+    }
+    return NULL;
+}
+
+/* claim the least recently used way for a new block */
+static bcache_entry_t *bcache_put(dev_t dev, ino_t ino, uint64_t off) {
+    bcache_entry_t *set = bcache_set(dev, ino, off);
+    if (!set) return NULL;
+    bcache_entry_t *victim = &set[0];
+    for (int w = 1; w < BCACHE_WAYS; ++w)
+        if (set[w].used < victim->used) victim = &set[w];
+    victim->dev = dev;
+    victim->ino = ino;
+    victim->off = off;
+    victim->used = 0; /* filled in once decoded */
+    return victim;
+}
+
+/* ------------ READER ------------ */
+typedef struct {
+    const unsigned char *base;
+    size_t len;
+    dev_t dev;
+    ino_t ino;
+} mapping_t;
+
+/* map a whole file read-only; the page cache is shared by every reader */
+static int map_file(const char *path, mapping_t *m, int advice) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0) { close(fd); return -1; }
+    m->len = st.st_size;
+    m->dev = st.st_dev;
+    m->ino = st.st_ino;
+    m->base = NULL;
+    if (m->len > 0) {
+        void *p = mmap(NULL, m->len, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) { close(fd); return -1; }
+        madvise(p, m->len, advice);
+        m->base = p;
+    }
+    close(fd);
+    return 0;
+}
+
+static void unmap_file(mapping_t *m) {
+    if (m->base) munmap((void *)m->base, m->len);
+}
+
+static int scan_raw(const char *path, logstore_chunk_fn fn, void *arg, logstore_stats_t *st) {
+    mapping_t m;
+    if (map_file(path, &m, MADV_SEQUENTIAL) < 0) return -1;
+    st->hot_bytes += m.len;
+    int stop = m.len ? fn((const char *)m.base, m.len, arg) : 0;
+    unmap_file(&m);
+    return stop;
+}
+
+/* an opened segment: the mapping plus where its index is */
+typedef struct {
+    mapping_t m;
+    uint64_t index_off;
+    uint32_t count;
+    size_t entry; /* index entry size for this version */
+} segment_t;
+
+/* -1 if the file is missing, 1 if it is not a usable segment, else 0 */
+static int segment_open(const char *path, segment_t *s) {
+    if (map_file(path, &s->m, MADV_SEQUENTIAL) < 0) return -1;
+    const unsigned char *seg = s->m.base;
+    size_t n = s->m.len;
+    if (n < SEG_HEADER_SIZE + SEG_TRAILER_SIZE || memcmp(seg, SEG_MAGIC, 4) != 0 ||
+        memcmp(seg + n - 4, SEG_MAGIC, 4) != 0) {
+        unmap_file(&s->m);
+        return 1;
+    }
+    uint32_t version = get32(seg + 4);
+    s->entry = version == 1 ? SEG_INDEX_ENTRY_V1 : SEG_INDEX_ENTRY;
+    const unsigned char *tr = seg + n - SEG_TRAILER_SIZE;
+    s->index_off = get64(tr);
+    s->count = get32(tr + 8);
+    if ((version != 1 && version != SEG_VERSION) || s->index_off > n - SEG_TRAILER_SIZE ||
+        (n - SEG_TRAILER_SIZE - s->index_off) / s->entry < s->count) {
+        unmap_file(&s->m);
+        return 1;
+    }
+    return 0;
+}
+
+/* lines in block b, or -1 when the index does not say (version 1) */
+static int64_t segment_block_lines(const segment_t *s, uint32_t b) {
+    if (s->entry < SEG_INDEX_ENTRY) return -1;
+    return get32(s->m.base + s->index_off + (size_t)b * s->entry + 16);
+}
+
+/* Block b decoded, from the block cache when it is there. *big holds
+   blocks too large for a cache slot (giant lines) and is the caller's to
+   free. NULL if the block is damaged. */
+static const char *segment_block(segment_t *s, uint32_t b, uint32_t *len, char **big,
+                                 logstore_stats_t *st) {
+    const unsigned char *e = s->m.base + s->index_off + (size_t)b * s->entry;
+    uint64_t off = get64(e);
+    uint32_t raw_len = get32(e + 8), comp_len = get32(e + 12);
+    if (raw_len > SEG_MAX_BLOCK || off + 8 + comp_len > s->index_off) return NULL;
+    const unsigned char *payload = s->m.base + off + 8;
+    *len = raw_len;
+
+    if (comp_len == raw_len) {
+        st->hot_bytes += raw_len;
+        return (const char *)payload;
+    }
+    st->blocks++;
+    st->comp_bytes += comp_len;
+    st->raw_bytes += raw_len;
+
+    bcache_entry_t *ce = bcache_get(s->m.dev, s->m.ino, off);
+    if (ce) {
+        st->cache_hits++;
+        return ce->data;
+    }
+    st->cache_misses++;
+
+    char *out;
+    if (raw_len <= LOG_BLOCK_SIZE && (ce = bcache_put(s->m.dev, s->m.ino, off))) out = ce->data;
+    else {
+        free(*big);
+        if (!(*big = malloc(raw_len))) return NULL;
+        out = *big;
+    }
+    double t0 = now_sec();
+    ssize_t got = lz_decompress(payload, comp_len, (unsigned char *)out, raw_len);
+    st->decode_sec += now_sec() - t0;
+    if (got != (ssize_t)raw_len) return NULL;
+    st->decoded_bytes += raw_len;
+    if (ce) {
+        ce->len = raw_len;
+        ce->used = ++bcache_tick;
+    }
+    return out;
+}
+
+static int scan_segment(const char *path, logstore_chunk_fn fn, void *arg, logstore_stats_t *st) {
+    segment_t s;
+    int rc = segment_open(path, &s);
+    if (rc != 0) return rc < 0 ? -1 : 0; /* not a segment; skip it */
+
+    char *big = NULL;
+    int stop = 0;
+    for (uint32_t b = 0; b < s.count && !stop; ++b) {
+        uint32_t len;
+        const char *data = segment_block(&s, b, &len, &big, st);
+        if (!data) break;
+        stop = fn(data, len, arg);
+    }
+    free(big);
+    unmap_file(&s.m);
+    return stop;
+}
+
+int logstore_scan(const char *dir, const char *room,
+                  logstore_chunk_fn fn, void *arg, logstore_stats_t *st) {
+    char path[256];
+    int found = 0;
+    memset(st, 0, sizeof(*st));
+
+    for (int seq = 0;; ++seq) {
+        int rc;
+        seg_path(path, sizeof(path), dir, room, seq, "seg");
+        rc = scan_segment(path, fn, arg, st);
+        if (rc < 0) {
+            /* not compressed yet (or compressor just finished) */
+            seg_path(path, sizeof(path), dir, room, seq, "roll");
+            rc = scan_raw(path, fn, arg, st);
+            if (rc < 0) {
+                seg_path(path, sizeof(path), dir, room, seq, "seg");
+                rc = scan_segment(path, fn, arg, st);
+            }
+        }
+        if (rc < 0) break;
+        found = 1;
+        if (rc > 0) return 0;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s.log", dir, room);
+    int rc = scan_raw(path, fn, arg, st);
+    if (rc >= 0) found = 1;
+    return found ? 0 : -1;
+}
+
+/* ------------ TAIL ------------ */
+/* A page of lines counted back from the newest, read newest first. The
+   wanted lines of each file or block are copied out as one piece (the
+   block cache may reuse the memory meanwhile) and handed over oldest
+   first at the end. */
+typedef struct {
+    uint64_t skip, stop; /* wanted: lines [skip, stop) back from the newest */
+    uint64_t seen;       /* lines passed so far */
+    struct {
+        char *data;
+        size_t len;
+    } *pieces;
+    size_t n_pieces, cap;
+    int failed;
+} tail_t;
+
+static int tail_full(const tail_t *t) {
+    return t->seen >= t->stop || t->failed;
+}
+
+/* walk the lines of one file or block backwards; 1 once the page is full */
+static int tail_chunk(tail_t *t, const char *data, size_t len) {
+    const char *nl = len ? memrchr(data, '\n', len) : NULL;
+    if (!nl) return tail_full(t); /* a partial last line is not history yet */
+    const char *p = nl + 1, *span_start = NULL, *span_end = NULL;
+    while (p > data && t->seen < t->stop) {
+        const char *prev = p - 1 > data ? memrchr(data, '\n', p - 1 - data) : NULL;
+        const char *start = prev ? prev + 1 : data;
+        if (t->seen >= t->skip) {
+            if (!span_end) span_end = p;
+            span_start = start;
+        }
+        t->seen++;
+        p = start;
+    }
+    if (span_end) {
+        if (t->n_pieces == t->cap) {
+            size_t cap = t->cap ? t->cap * 2 : 8;
+            void *np = realloc(t->pieces, cap * sizeof(*t->pieces));
+            if (!np) {
+                t->failed = 1;
+                return 1;
+            }
+            t->pieces = np;
+            t->cap = cap;
+        }
+        size_t n = span_end - span_start;
+        char *copy = malloc(n);
+        if (!copy) {
+            t->failed = 1;
+            return 1;
+        }
+        memcpy(copy, span_start, n);
+        t->pieces[t->n_pieces].data = copy;
+        t->pieces[t->n_pieces].len = n;
+        t->n_pieces++;
+    }
+    return tail_full(t);
+}
+
+static int tail_raw(const char *path, tail_t *t, logstore_stats_t *st) {
+    mapping_t m;
+    if (map_file(path, &m, MADV_RANDOM) < 0) return -1;
+    st->hot_bytes += m.len;
+    int full = tail_chunk(t, (const char *)m.base, m.len);
+    unmap_file(&m);
+    return full;
+}
+
+static int tail_segment(const char *path, tail_t *t, logstore_stats_t *st) {
+    segment_t s;
+    int rc = segment_open(path, &s);
+    if (rc != 0) return rc < 0 ? -1 : 0;
+
+    char *big = NULL;
+    int full = 0;
+    for (uint32_t b = s.count; b-- > 0 && !full;) {
+        int64_t lines = segment_block_lines(&s, b);
+        if (lines >= 0 && t->seen + lines <= t->skip) {
+            t->seen += lines; /* newer than the page: no need to decode it */
+            continue;
+        }
+        uint32_t len;
+        const char *data = segment_block(&s, b, &len, &big, st);
+        if (!data) break;
+        full = tail_chunk(t, data, len);
+    }
+    free(big);
+    unmap_file(&s.m);
+    return full;
+}
+
+long logstore_tail(const char *dir, const char *room, uint64_t skip, uint64_t want,
+                   logstore_chunk_fn fn, void *arg, logstore_stats_t *st) {
+    char path[256], roll[256];
+    tail_t t = {.skip = skip, .stop = skip + want};
+    memset(st, 0, sizeof(*st));
+
+    snprintf(path, sizeof(path), "%s/%s.log", dir, room);
+    int rc = tail_raw(path, &t, st);
+    int found = rc >= 0;
+
+    int top = 0;
+    for (;; ++top) {
+        seg_path(path, sizeof(path), dir, room, top, "seg");
+        seg_path(roll, sizeof(roll), dir, room, top, "roll");
+        if (!file_exists(path) && !file_exists(roll)) break;
+    }
+    for (int seq = top - 1; seq >= 0 && rc <= 0; --seq) {
+        /* same order as logstore_scan: the compressor may finish meanwhile */
+        seg_path(path, sizeof(path), dir, room, seq, "seg");
+        rc = tail_segment(path, &t, st);
+        if (rc < 0) {
+            seg_path(path, sizeof(path), dir, room, seq, "roll");
+            rc = tail_raw(path, &t, st);
+            if (rc < 0) {
+                seg_path(path, sizeof(path), dir, room, seq, "seg");
+                rc = tail_segment(path, &t, st);
+            }
+        }
+        if (rc >= 0) found = 1;
+    }
+
+    for (size_t k = t.n_pieces; k-- > 0;) {
+        if (!t.failed) fn(t.pieces[k].data, t.pieces[k].len, arg);
+        free(t.pieces[k].data);
+    }
+    free(t.pieces);
+    if (!found) return -1;
+    if (t.failed) return 0;
+    uint64_t end = t.seen < t.stop ? t.seen : t.stop;
+    return end > skip ? (long)(end - skip) : 0;
+}
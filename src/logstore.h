@@ -0,0 +1,48 @@
+/* logstore.h
+   Room log storage: a hot append-only text log (logs/<room>.log) plus
+   cold segments (logs/<room>.<seq>.seg) holding line-aligned blocks
+   compressed with the lz codec and an index for random access.
+   Readers mmap files and keep decoded blocks in a small shared cache.
+*/
+#ifndef LOGSTORE_H
+#define LOGSTORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOG_BLOCK_SIZE 16384
+
+typedef struct {
+    size_t blocks;        /* compressed blocks served */
+    size_t comp_bytes;    /* their compressed size */
+    size_t raw_bytes;     /* their decoded size */
+    size_t decoded_bytes; /* bytes actually decoded (cache misses) */
+    size_t hot_bytes;     /* bytes read from uncompressed files */
+    size_t cache_hits;    /* blocks served from the block cache */
+    size_t cache_misses;
+    double decode_sec;    /* time spent in lz_decompress */
+} logstore_stats_t;
+
+/* called with whole lines; return non-zero to stop the scan */
+typedef int (*logstore_chunk_fn)(const char *data, size_t len, void *arg);
+
+/* move the hot log aside and compress it in a background child.
+   Returns the child's pid, or -1 on failure. */
+int logstore_rotate(const char *dir, const char *room);
+
+/* compress a raw log file into a segment file; 0 on success */
+int logstore_compress_file(const char *src, const char *dst);
+
+/* feed all history for a room, oldest first, to fn.
+   Returns -1 when the room has no history at all. */
+int logstore_scan(const char *dir, const char *room,
+                  logstore_chunk_fn fn, void *arg, logstore_stats_t *st);
+
+/* feed up to want lines that sit skip lines back from the newest to fn,
+   oldest first. Reads backwards from the newest file and only decodes the
+   blocks the page is in. Returns the number of lines fed, or -1 when the
+   room has no history at all. */
+long logstore_tail(const char *dir, const char *room, uint64_t skip, uint64_t want,
+                   logstore_chunk_fn fn, void *arg, logstore_stats_t *st);
+
+#endif
@@ -0,0 +1,131 @@
+/* lz.c
+   LZ77 block codec. Stream is a sequence of:
+     token (hi nibble = literal length, lo nibble = match length - 4)
+     [extra literal length bytes] literals
+     offset (u16 little endian) [extra match length bytes]
+   Lengths >= 15 continue in following bytes (255 = keep going).
+   The last sequence carries literals only.
+*/
+#include "lz.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 65535
+
+static inline uint32_t read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* write a length continuation (value already reduced by 15) */
+static unsigned char *put_len(unsigned char *op, size_t len) {
+    while (len >= 255) { *op++ = 255; len -= 255; }
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+static unsigned char *emit(unsigned char *op, unsigned char *oend,
+                           const unsigned char *lit, size_t litlen,
+                           size_t offset, size_t mlen) {
+    /* token + literal len + literals + offset + match len */
+    if ((size_t)(oend - op) < 1 + litlen / 255 + 1 + litlen + 2 + mlen / 255 + 1)
+        return NULL;
+    unsigned char *token = op++;
+    *token = (unsigned char)((litlen >= 15 ? 15 : litlen) << 4);
+    if (litlen >= 15) op = put_len(op, litlen - 15);
+    memcpy(op, lit, litlen);
+    op += litlen;
+    if (mlen == 0) return op;
+
+    *op++ = (unsigned char)(offset & 0xff);
+    *op++ = (unsigned char)(offset >> 8);
+    size_t m = mlen - LZ_MIN_MATCH;
+    *token |= (unsigned char)(m >= 15 ? 15 : m);
+    if (m >= 15) op = put_len(op, m - 15);
+    return op;
+}
+
+size_t lz_compress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap) {
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    unsigned char *op = dst, *oend = dst + cap;
+    size_t ip = 0, anchor = 0;
+
+    while (ip + LZ_MIN_MATCH <= n) {
+        uint32_t seq = read32(src + ip);
+        uint32_t h = lz_hash(seq);
+        size_t ref = table[h];
+        table[h] = (uint32_t)ip + 1;
+
+        if (ref == 0 || ip - (ref - 1) > LZ_MAX_OFFSET || read32(src + ref - 1) != seq) {
+            ip++;
+            continue;
+        }
+        ref--;
+        size_t mlen = LZ_MIN_MATCH;
+        while (ip + mlen < n && src[ref + mlen] == src[ip + mlen]) mlen++;
+
+        op = emit(op, oend, src + anchor, ip - anchor, ip - ref, mlen);
+        if (!op) return 0;
+        ip += mlen;
+        anchor = ip;
+    }
+
+    op = emit(op, oend, src + anchor, n - anchor, 0, 0);
+    if (!op) return 0;
+    return (size_t)(op - dst);
+}
+
+/* read a length continuation; returns false on truncated input */
+static int get_len(const unsigned char **ip, const unsigned char *iend, size_t *len) {
+    unsigned char b;
+    do {
+        if (*ip >= iend) return 0;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 1;
+}
+
+ssize_t lz_decompress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap) {
+    const unsigned char *ip = src, *iend = src + n;
+    unsigned char *op = dst, *oend = dst + cap;
+
+    while (ip < iend) {
+        unsigned char token = *ip++;
+        size_t litlen = token >> 4;
+        if (litlen == 15 && !get_len(&ip, iend, &litlen)) return -1;
+        if ((size_t)(iend - ip) < litlen || (size_t)(oend - op) < litlen) return -1;
+        memcpy(op, ip, litlen);
+        ip += litlen;
+        op += litlen;
+        if (ip == iend) break; /* last sequence: literals only */
+
+        if (iend - ip < 2) return -1;
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        size_t mlen = token & 15;
+        if (mlen == 15 && !get_len(&ip, iend, &mlen)) return -1;
+        mlen += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > (size_t)(op - dst)) return -1;
+        if ((size_t)(oend - op) < mlen) return -1;
+        const unsigned char *ref = op - offset;
+        if (offset >= mlen) {
+            memcpy(op, ref, mlen);
+            op += mlen;
+        } else {
+            while (mlen--) *op++ = *ref++; /* overlapping run */
+        }
+    }
+    return (ssize_t)(op - dst);
+}
@@ -0,0 +1,20 @@
+/* lz.h
+   Small in-tree LZ77 block codec (LZ4-style token stream) used for
+   compressed room log segments. Each call handles one independent block.
+*/
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* worst-case compressed size for n input bytes */
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+/* returns compressed size, or 0 if dst is too small */
+size_t lz_compress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap);
+
+/* returns decompressed size, or -1 on corrupt input / short dst */
+ssize_t lz_decompress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap);
+
+#endif
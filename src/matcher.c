@@ -0,0 +1,634 @@
+/* matcher.c
+   Words go into 8 buckets by the low bits of their first character, two
+   of them kept for words that may start inside a token. For each bucket
+   the prefilter keeps one bit in four 16-entry tables (low and high
+   nibble of byte 0 and of byte 1); a position is a candidate for bucket b
+   when bit b survives ANDing the four lookups of its (lowercased) bytes,
+   and after a word character only the inside-a-token buckets survive.
+   With pshufb that is a handful of operations per 16 or 32 input bytes;
+   the last partial block is an overlapping load (or a padded copy for a
+   short line), so chat-sized lines stay on the vector path. The scalar
+   kernel uses a 64K-bit bigram bitmap instead. Every candidate is
+   confirmed against that bitmap and a second one for bytes 1-2 before it
+   is verified against the words sharing its first character, longest
+   match wins: verify() is where the time goes, so confirm() has to be
+   selective.
+
+   Verification reads normalised characters (see decode()): case and
+   common leetspeak are folded, fullwidth Latin letters read as ASCII and
+   invisible code points are skipped. Words are stored as runs of one
+   character so "fuuuck" matches "fuck" while "as" still does not match
+   "ass". The prefilter tables are built from every byte that can fold to
+   a word's first two characters, so this stays a single pass; the vector
+   tables cover ASCII only, and a block holding any byte >= 0x80 is
+   handed to the scalar kernel, whose bitmap also knows the UTF-8 lead
+   bytes.
+
+   Matches are masked lazily: the current run of '*' is only written once
+   the scan has moved past it, so overlapping words are all found in the
+   original text and masked as one run.
+*/
+#include "matcher.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MATCHER_X86 1
+#endif
+
+#define N_BUCKETS 8
+#define N_INWORD 2 /* buckets kept for words that may start inside a token */
+#define MAX_RUNS 255
+
+#define W_START 1 /* must begin a token */
+#define W_END 2   /* must end a token */
+
+#define NC_SKIP (-1) /* decode(): invisible, ignore */
+
+typedef struct {
+    uint8_t ch;  /* folded character */
+    uint8_t min; /* repetitions the word spells out */
+} run_t;
+
+typedef struct {
+    run_t *runs;
+    uint8_t n_runs;
+    uint8_t flags;
+    int16_t second; /* second character, -1 if any will do */
+} word_t;
+
+struct matcher {
+    word_t *words;
+    size_t n_words;
+    uint32_t first[257]; /* words sorted by first character: [first[c], first[c+1]) */
+    /* nibble tables (ASCII bytes only), 16 bytes each, bucket bits */
+    uint8_t lo0[16], hi0[16], lo1[16], hi1[16];
+    /* buckets holding a word that may start inside a token */
+    uint8_t inword;
+    /* ASCII bytes that read as a word character (see is_word_char) */
+    uint8_t word_byte[256];
+    /* scalar prefilter: bucket bits per lowercased bigram */
+    uint8_t bigram[65536];
+    /* confirmation: bucket bits per lowercased pair of bytes 1 and 2 */
+    uint8_t bigram2[65536];
+};
+
+typedef size_t (*kernel_fn)(const matcher_t *m, char *text, size_t len);
+
+static inline unsigned char lower(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? c + 32 : c;
+}
+
+/* ------------ NORMALISE ------------ */
+/* ASCII folding: case plus the usual digit/symbol stand-ins */
+static inline int fold(unsigned c) {
+    if (c - 'a' < 26) return c;
+    if (c - 'A' < 26) return c + 32;
+    switch (c) {
+    case '0': return 'o';
+    case '1': return 'i';
+    case '3': return 'e';
+    case '4': case '@': return 'a';
+    case '5': case '$': return 's';
+    case '7': return 't';
+    }
+    return c;
+}
+
+/* decode() past ASCII, kept out of line so the common case stays small */
+static __attribute__((noinline)) int decode_high(const unsigned char *t, size_t len, size_t p,
+                                                 size_t *adv) {
+    unsigned c = t[p];
+    if (c == 0xC2 && p + 1 < len && t[p + 1] == 0xAD) { *adv = 2; return NC_SKIP; }
+    if (p + 2 >= len) return c;
+    unsigned c1 = t[p + 1], c2 = t[p + 2];
+    if (c == 0xE2 && ((c1 == 0x80 && c2 >= 0x8B && c2 <= 0x8D) || (c1 == 0x81 && c2 == 0xA0))) {
+        *adv = 3;
+        return NC_SKIP;
+    }
+    if (c == 0xEF) {
+        if (c1 == 0xBB && c2 == 0xBF) { *adv = 3; return NC_SKIP; }
+        if (c1 == 0xBC && c2 >= 0xA1 && c2 <= 0xBA) { *adv = 3; return 'a' + (c2 - 0xA1); }
+        if (c1 == 0xBD && c2 >= 0x81 && c2 <= 0x9A) { *adv = 3; return 'a' + (c2 - 0x81); }
+    }
+    return c;
+}
+
+/* One character at t[p]: its folded value, NC_SKIP for soft hyphen,
+   zero-width space/(non-)joiner, word joiner and BOM, or the raw byte
+   for anything else >= 0x80. *adv is set to its length in bytes. */
+static inline int decode(const unsigned char *t, size_t len, size_t p, size_t *adv) {
+    *adv = 1;
+    if (t[p] < 0x80) return fold(t[p]);
+    return decode_high(t, len, p, adv);
+}
+
+static inline int is_word_char(int ch) {
+    return (ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9') || ch >= 0x80;
+}
+
+/* the visible character before t[p]; text start reads as a space */
+static int prev_char(const unsigned char *t, size_t p) {
+    while (p > 0) {
+        if (t[p - 1] < 0x80) return fold(t[p - 1]);
+        size_t s = p - 1, adv;
+        while (s > 0 && p - s < 3 && (t[s] & 0xC0) == 0x80) s--;
+        int ch = decode(t, p, s, &adv);
+        if (s + adv != p) return t[p - 1]; /* not a sequence we know */
+        if (ch != NC_SKIP) return ch;
+        p = s;
+    }
+    return ' ';
+}
+
+/* ------------ BUILD ------------ */
+/* "word" must be a whole token; a leading or trailing '*' lifts the
+   boundary on that side ("fuck*", "*fuck*") */
+static int parse_word(const char *src, word_t *w) {
+    size_t len = strlen(src);
+    w->flags = W_START | W_END;
+    if (len && src[0] == '*') { w->flags &= ~W_START; src++; len--; }
+    if (len && src[len - 1] == '*') { w->flags &= ~W_END; len--; }
+    run_t runs[MAX_RUNS];
+    unsigned n = 0;
+    const unsigned char *s = (const unsigned char *)src;
+    for (size_t p = 0, adv; p < len; p += adv) {
+        int ch = decode(s, len, p, &adv);
+        if (ch == NC_SKIP) continue;
+        if (n && runs[n - 1].ch == ch) {
+            if (runs[n - 1].min < UINT8_MAX) runs[n - 1].min++;
+            continue;
+        }
+        if (n == MAX_RUNS) return -1;
+        runs[n].ch = (uint8_t)ch;
+        runs[n].min = 1;
+        n++;
+    }
+    if (n == 0) return -1;
+    if (!(w->runs = malloc(n * sizeof(*w->runs)))) return -1;
+    memcpy(w->runs, runs, n * sizeof(*runs));
+    w->n_runs = (uint8_t)n;
+    if (runs[0].min > 1) w->second = runs[0].ch;
+    else w->second = n > 1 ? runs[1].ch : -1;
+    return 0;
+}
+
+/* every lowercased byte that decodes to ch at the start of a character */
+static size_t variants(int ch, uint8_t *out) {
+    size_t n = 0;
+    if (ch >= 0x80) { out[n++] = (uint8_t)ch; return n; }
+    for (unsigned b = 0; b < 128; ++b)
+        if (fold(b) == ch && lower(b) == b) out[n++] = (uint8_t)b;
+    if (ch >= 'a' && ch <= 'z') out[n++] = 0xEF; /* fullwidth */
+    return n;
+}
+
+static void mark_ascii(uint8_t *lo, uint8_t *hi, uint8_t byte, uint8_t bit) {
+    if (byte >= 0x80) return; /* such blocks go to the scalar kernel */
+    lo[byte & 15] |= bit;
+    hi[byte >> 4] |= bit;
+}
+
+/* by the low bits of the first character: each bucket then admits few
+   first bytes, which keeps the nibble prefilter selective. Words that may
+   start inside a token get buckets of their own, so that inside a word
+   the kernels can drop every other bucket. */
+static unsigned bucket_of(const word_t *w) {
+    unsigned c0 = w->runs[0].ch;
+    if (w->flags & W_START) return c0 % (N_BUCKETS - N_INWORD);
+    return N_BUCKETS - N_INWORD + c0 % N_INWORD;
+}
+
+static void add_prefilter(matcher_t *m, const word_t *w, unsigned b) {
+    uint8_t bit = 1u << b;
+    int c0 = w->runs[0].ch, c1 = w->second;
+    uint8_t v0[130], v1[260];
+    size_t n0 = variants(c0, v0), n1 = 0;
+    if (c1 >= 0) {
+        n1 = variants(c1, v1);
+        n1 += variants(c0, v1 + n1); /* a repeated first letter */
+        v1[n1++] = 0xC2;             /* invisible code points */
+        v1[n1++] = 0xE2;
+        v1[n1++] = 0xEF;
+    }
+    for (size_t i = 0; i < n0; ++i) {
+        mark_ascii(m->lo0, m->hi0, v0[i], bit);
+        if (c1 < 0) {
+            for (int j = 0; j < 256; ++j) m->bigram[v0[i] << 8 | j] |= bit;
+            continue;
+        }
+        if (v0[i] == 0xEF) {
+            /* fullwidth lead: the second byte is the block selector */
+            m->bigram[0xEF << 8 | 0xBC] |= bit;
+            m->bigram[0xEF << 8 | 0xBD] |= bit;
+            continue;
+        }
+        for (size_t j = 0; j < n1; ++j) m->bigram[v0[i] << 8 | v1[j]] |= bit;
+    }
+    if (c1 < 0) {
+        for (int j = 0; j < 16; ++j) { m->lo1[j] |= bit; m->hi1[j] |= bit; }
+        return;
+    }
+    for (size_t j = 0; j < n1; ++j) mark_ascii(m->lo1, m->hi1, v1[j], bit);
+}
+
+/* bucket bit for every (x, y) with x in variants of a and y in
+   variants of b; -1 stands for any byte */
+static void mark_pairs(uint8_t *tab, int a, int b, uint8_t bit) {
+    uint8_t va[256], vb[256];
+    size_t na = 0, nb = 0;
+    if (a < 0) for (int c = 0; c < 256; ++c) va[na++] = (uint8_t)c;
+    else na = variants(a, va);
+    if (b < 0) for (int c = 0; c < 256; ++c) vb[nb++] = (uint8_t)c;
+    else nb = variants(b, vb);
+    for (size_t i = 0; i < na; ++i)
+        for (size_t j = 0; j < nb; ++j) tab[va[i] << 8 | vb[j]] |= bit;
+}
+
+/* Bytes 1 and 2 of a match spell characters 1 and 2 of the word with
+   any run stretched: s0 s0, s0 s1, s1 s1 or s1 s2, where s is the word
+   with each run written out min times. A two-character word may be
+   followed by anything; bytes >= 0x80 (invisible, fullwidth) always pass,
+   see matcher_new(). */
+static void add_confirm(matcher_t *m, const word_t *w, unsigned b) {
+    uint8_t bit = 1u << b;
+    int s[3] = {0, 0, 0};
+    unsigned k = 0;
+    for (unsigned i = 0; i < w->n_runs && k < 3; ++i)
+        for (unsigned j = 0; j < w->runs[i].min && k < 3; ++j) s[k++] = w->runs[i].ch;
+    if (k == 1) {
+        mark_pairs(m->bigram2, -1, -1, bit);
+        return;
+    }
+    mark_pairs(m->bigram2, s[0], s[0], bit);
+    mark_pairs(m->bigram2, s[0], s[1], bit);
+    mark_pairs(m->bigram2, s[1], s[1], bit);
+    mark_pairs(m->bigram2, s[1], k > 2 ? s[2] : -1, bit);
+}
+
+static int cmp_first(const void *a, const void *b) {
+    return ((const word_t *)a)->runs[0].ch - ((const word_t *)b)->runs[0].ch;
+}
+
+matcher_t *matcher_new(const char *const *words, size_t n) {
+    matcher_t *m = calloc(1, sizeof(*m));
+    if (!m) return NULL;
+    if (!(m->words = calloc(n ? n : 1, sizeof(*m->words)))) { matcher_free(m); return NULL; }
+
+    for (size_t k = 0; k < n; ++k) {
+        word_t *w = &m->words[m->n_words];
+        if (parse_word(words[k], w) < 0) continue;
+        m->n_words++;
+        add_prefilter(m, w, bucket_of(w));
+        add_confirm(m, w, bucket_of(w));
+        if (!(w->flags & W_START)) m->inword |= 1u << bucket_of(w);
+    }
+    for (unsigned b = 0; b < 128; ++b) m->word_byte[b] = is_word_char(fold(b));
+    for (unsigned x = 0; x < 256; ++x)
+        for (unsigned y = 0x80; y < 256; ++y) m->bigram2[x << 8 | y] = m->bigram2[y << 8 | x] = 0xff;
+    qsort(m->words, m->n_words, sizeof(*m->words), cmp_first);
+    for (size_t k = 0, c = 0; c <= 256; ++c) {
+        while (k < m->n_words && m->words[k].runs[0].ch < c) k++;
+        m->first[c] = (uint32_t)k;
+    }
+    return m;
+}
+
+void matcher_free(matcher_t *m) {
+    if (!m) return;
+    for (size_t k = 0; k < m->n_words; ++k) free(m->words[k].runs);
+    free(m->words);
+    free(m);
+}
+
+/* ------------ VERIFY ------------ */
+typedef struct {
+    size_t from, to; /* pending run of '*', empty when from == to */
+    size_t matches;
+} mask_run_t;
+
+static inline void run_flush(mask_run_t *r, char *text) {
+    if (r->to > r->from) memset(text + r->from, '*', r->to - r->from);
+    r->from = r->to = 0;
+}
+
+/* the first visible character at or after t[p], -1 at the end */
+static inline int next_visible(const unsigned char *t, size_t len, size_t p) {
+    size_t adv;
+    for (; p < len; p += adv) {
+        int ch = decode(t, len, p, &adv);
+        if (ch != NC_SKIP) return ch;
+    }
+    return -1;
+}
+
+/* the first visible character at or after t[p] other than c, -1 at the end */
+static inline int next_other(const unsigned char *t, size_t len, size_t p, int c) {
+    size_t adv;
+    for (; p < len; p += adv) {
+        int ch = decode(t, len, p, &adv);
+        if (ch != NC_SKIP && ch != c) return ch;
+    }
+    return -1;
+}
+
+/* end of w matched at t[q], or 0 */
+static size_t match_at(const word_t *w, const unsigned char *t, size_t len, size_t q) {
+    size_t p = q, adv;
+    for (unsigned k = 0; k < w->n_runs; ++k) {
+        unsigned got = 0;
+        while (p < len) {
+            int ch = decode(t, len, p, &adv);
+            if (ch == NC_SKIP) {
+                if (p == q) return 0;
+                p += adv;
+                continue;
+            }
+            if (ch != w->runs[k].ch) break;
+            got++;
+            p += adv;
+        }
+        if (got < w->runs[k].min) return 0;
+    }
+    if ((w->flags & W_END) && is_word_char(next_visible(t, len, p))) return 0;
+    return p;
+}
+
+/* check the words starting with the character at text[q] */
+static void verify(const matcher_t *m, char *text, size_t len, size_t q, mask_run_t *r) {
+    const unsigned char *t = (const unsigned char *)text;
+    size_t best = 0, adv;
+    int c0 = decode(t, len, q, &adv);
+    if (c0 < 0) return;
+    /* a stretched first letter may stand before the second: look past it */
+    int c1 = next_visible(t, len, q + adv);
+    int cn = c1 == c0 ? next_other(t, len, q + adv, c0) : c1;
+    int at_start = -1; /* lazily: is q the start of a token? */
+    for (uint32_t k = m->first[c0]; k < m->first[c0 + 1]; ++k) {
+        const word_t *w = &m->words[k];
+        if (w->second >= 0 && w->second != (w->second == c0 ? c1 : cn)) continue;
+        if (w->flags & W_START) {
+            if (at_start < 0) at_start = !is_word_char(prev_char(t, q));
+            if (!at_start) continue;
+        }
+        size_t end = match_at(w, t, len, q);
+        if (end > best) best = end;
+    }
+    if (!best) return;
+    r->matches++;
+    if (q <= r->to && r->to > r->from) {
+        if (best > r->to) r->to = best; /* overlaps the pending run */
+    } else {
+        run_flush(r, text);
+        r->from = q;
+        r->to = best;
+    }
+}
+
+/* ------------ KERNELS ------------ */
+/* Bucket bits of a candidate at text[q] that survive the exact bigrams
+   of bytes 0-1 and 1-2 and, for buckets whose words all start a token,
+   an ASCII word character just before q. Most prefilter hits are common
+   word starts ("when" against "whore") or bigrams inside longer words
+   ("as" in "class"); verify() costs far more than these lookups. */
+static inline unsigned confirm(const matcher_t *m, const char *text, size_t len, size_t q) {
+    /* past the end only words short enough (which fill their row) match */
+    unsigned c1 = q + 1 < len ? lower(text[q + 1]) : 0;
+    unsigned c2 = q + 2 < len ? lower(text[q + 2]) : 0;
+    unsigned bits = m->bigram[lower(text[q]) << 8 | c1];
+    if (bits) bits &= m->bigram2[c1 << 8 | c2];
+    if (bits && q > 0 && m->word_byte[(unsigned char)text[q - 1]]) bits &= m->inword;
+    return bits;
+}
+
+static void scan_scalar(const matcher_t *m, char *text, size_t len, size_t p, size_t end,
+                        mask_run_t *r) {
+    for (; p < end; ++p)
+        if (confirm(m, text, len, p)) verify(m, text, len, p, r);
+}
+
+static size_t kernel_scalar(const matcher_t *m, char *text, size_t len) {
+    mask_run_t r = {0, 0, 0};
+    scan_scalar(m, text, len, 0, len, &r);
+    run_flush(&r, text);
+    return r.matches;
+}
+
+#ifdef MATCHER_X86
+/* nibble candidates are a superset: confirm them before verify() */
+static inline void verify_hits(const matcher_t *m, char *text, size_t len, size_t base,
+                               uint32_t hits, mask_run_t *r) {
+    while (hits) {
+        size_t q = base + __builtin_ctz(hits);
+        hits &= hits - 1;
+        if (confirm(m, text, len, q)) verify(m, text, len, q, r);
+    }
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i lower16(__m128i v) {
+    /* 'A'..'Z' land on -128..-103 after the shift */
+    __m128i t = _mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - 'A')));
+    __m128i is_upper = _mm_cmplt_epi8(t, _mm_set1_epi8((char)(-128 + 26)));
+    return _mm_or_si128(v, _mm_and_si128(is_upper, _mm_set1_epi8(0x20)));
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i nibble_lookup16(__m128i v, __m128i lo, __m128i hi) {
+    __m128i nib = _mm_set1_epi8(0x0f);
+    __m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(v, nib));
+    __m128i h = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(v, 4), nib));
+    return _mm_and_si128(l, h);
+}
+
+/* buckets allowed after each byte of v: all of them, or only m->inword
+   after an ASCII word character (word_byte[]: letters, digits, '@', '$') */
+__attribute__((target("ssse3")))
+static inline __m128i gate16(__m128i v, uint8_t inword) {
+    __m128i l = lower16(v);
+    __m128i alpha = _mm_cmplt_epi8(_mm_add_epi8(l, _mm_set1_epi8((char)(0x80 - 'a'))),
+                                   _mm_set1_epi8((char)(-128 + 26)));
+    __m128i digit = _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - '0'))),
+                                   _mm_set1_epi8((char)(-128 + 10)));
+    __m128i sym = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('@')),
+                               _mm_cmpeq_epi8(v, _mm_set1_epi8('$')));
+    __m128i word = _mm_or_si128(_mm_or_si128(alpha, digit), sym);
+    return _mm_or_si128(_mm_andnot_si128(word, _mm_set1_epi8(-1)), _mm_set1_epi8(inword));
+}
+
+/* Candidate positions in s[0..15], reading s[-1..16] (s[-1] only when
+   at_start is 0), or -1 if the block holds UTF-8. */
+__attribute__((target("ssse3")))
+static inline int32_t block16(const matcher_t *m, const char *s, int at_start) {
+    __m128i raw0 = _mm_loadu_si128((const __m128i *)s);
+    __m128i raw1 = _mm_loadu_si128((const __m128i *)(s + 1));
+    if (_mm_movemask_epi8(_mm_or_si128(raw0, raw1))) return -1;
+    /* a zero byte before the text start is not a word character */
+    __m128i prev = at_start ? _mm_slli_si128(raw0, 1) : _mm_loadu_si128((const __m128i *)(s - 1));
+    __m128i c0 = nibble_lookup16(lower16(raw0), _mm_loadu_si128((const __m128i *)m->lo0),
+                                 _mm_loadu_si128((const __m128i *)m->hi0));
+    __m128i c1 = nibble_lookup16(lower16(raw1), _mm_loadu_si128((const __m128i *)m->lo1),
+                                 _mm_loadu_si128((const __m128i *)m->hi1));
+    __m128i cand = _mm_and_si128(_mm_and_si128(c0, c1), gate16(prev, m->inword));
+    return ~_mm_movemask_epi8(_mm_cmpeq_epi8(cand, _mm_setzero_si128())) & 0xffff;
+}
+
+/* Positions p..len-1, fewer than 17 of them. A long enough text gets one
+   more block ending at its last byte, overlapping what was already
+   scanned; a short one is copied into a zero-padded block, the padding
+   reading like the end of the text does in confirm(). */
+__attribute__((target("ssse3")))
+static void tail16(const matcher_t *m, char *text, size_t len, size_t p, mask_run_t *r) {
+    if (p >= len) return;
+    if (len >= 17) {
+        size_t base = len - 17;
+        int32_t hits = block16(m, text + base, base == 0);
+        if (hits < 0) {
+            scan_scalar(m, text, len, p, len, r);
+            return;
+        }
+        verify_hits(m, text, len, base, (uint32_t)hits & (0xffffu << (p - base)), r);
+        scan_scalar(m, text, len, len - 1, len, r);
+        return;
+    }
+    char pad[32] = {0};
+    memcpy(pad, text, len);
+    int32_t hits = block16(m, pad, 1);
+    if (hits < 0) scan_scalar(m, text, len, 0, len, r);
+    else verify_hits(m, text, len, 0, (uint32_t)hits & ((1u << len) - 1), r);
+}
+
+__attribute__((target("ssse3")))
+static size_t kernel_ssse3(const matcher_t *m, char *text, size_t len) {
+    mask_run_t r = {0, 0, 0};
+    size_t p = 0;
+    for (; p + 17 <= len; p += 16) {
+        int32_t hits = block16(m, text + p, p == 0);
+        if (hits < 0) scan_scalar(m, text, len, p, p + 16, &r); /* UTF-8 in the block */
+        else verify_hits(m, text, len, p, (uint32_t)hits, &r);
+    }
+    tail16(m, text, len, p, &r);
+    run_flush(&r, text);
+    return r.matches;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i lower32(__m256i v) {
+    __m256i t = _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - 'A')));
+    __m256i is_upper = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(-128 + 26)), t);
+    return _mm256_or_si256(v, _mm256_and_si256(is_upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i nibble_lookup32(__m256i v, __m256i lo, __m256i hi) {
+    __m256i nib = _mm256_set1_epi8(0x0f);
+    __m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(v, nib));
+    __m256i h = _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), nib));
+    return _mm256_and_si256(l, h);
+}
+
+/* gate16() on 32 bytes */
+__attribute__((target("avx2")))
+static inline __m256i gate32(__m256i v, uint8_t inword) {
+    __m256i l = lower32(v);
+    __m256i alpha = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(-128 + 26)),
+                                      _mm256_add_epi8(l, _mm256_set1_epi8((char)(0x80 - 'a'))));
+    __m256i digit = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(-128 + 10)),
+                                      _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - '0'))));
+    __m256i sym = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('@')),
+                                  _mm256_cmpeq_epi8(v, _mm256_set1_epi8('$')));
+    __m256i word = _mm256_or_si256(_mm256_or_si256(alpha, digit), sym);
+    return _mm256_or_si256(_mm256_andnot_si256(word, _mm256_set1_epi8(-1)),
+                           _mm256_set1_epi8(inword));
+}
+
+__attribute__((target("avx2")))
+static size_t kernel_avx2(const matcher_t *m, char *text, size_t len) {
+    mask_run_t r = {0, 0, 0};
+    /* vpshufb looks up within each 128-bit lane: same table in both */
+    __m256i lo0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)m->lo0));
+    __m256i hi0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)m->hi0));
+    __m256i lo1 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)m->lo1));
+    __m256i hi1 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)m->hi1));
+    __m256i zero = _mm256_setzero_si256();
+    size_t p = 0;
+    for (; p + 33 <= len; p += 32) {
+        __m256i raw0 = _mm256_loadu_si256((const __m256i *)(text + p));
+        __m256i raw1 = _mm256_loadu_si256((const __m256i *)(text + p + 1));
+        if (_mm256_movemask_epi8(_mm256_or_si256(raw0, raw1))) {
+            scan_scalar(m, text, len, p, p + 32, &r); /* UTF-8 in the block */
+            continue;
+        }
+        /* at the start, shift a zero byte in across the lanes */
+        __m256i prev = p ? _mm256_loadu_si256((const __m256i *)(text + p - 1))
+                         : _mm256_alignr_epi8(raw0, _mm256_permute2x128_si256(raw0, raw0, 0x08), 15);
+        __m256i cand = _mm256_and_si256(nibble_lookup32(lower32(raw0), lo0, hi0),
+                                        nibble_lookup32(lower32(raw1), lo1, hi1));
+        cand = _mm256_and_si256(cand, gate32(prev, m->inword));
+        verify_hits(m, text, len, p,
+                    ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(cand, zero)), &r);
+    }
+    /* at most 32 left: one 16-byte block, then the overlapping tail */
+    if (p + 17 <= len) {
+        int32_t hits = block16(m, text + p, p == 0);
+        if (hits < 0) scan_scalar(m, text, len, p, p + 16, &r);
+        else verify_hits(m, text, len, p, (uint32_t)hits, &r);
+        p += 16;
+    }
+    tail16(m, text, len, p, &r);
+    run_flush(&r, text);
+    return r.matches;
+}
+#endif
+/* ------------ DISPATCH ------------ */
+static const struct {
+    const char *name;
+    kernel_fn fn;
+} kernels[] = {
+#ifdef MATCHER_X86
+    {"avx2", kernel_avx2},
+    {"ssse3", kernel_ssse3},
+#endif
+    {"scalar", kernel_scalar},
+};
+#define N_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static int active = -1;
+
+static int supported(const char *name) {
+#ifdef MATCHER_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if (strcmp(name, "ssse3") == 0) return __builtin_cpu_supports("ssse3");
+#endif
+    return strcmp(name, "scalar") == 0;
+}
+
+static int pick(void) {
+    if (active < 0) {
+        active = N_KERNELS - 1;
+        for (size_t k = 0; k < N_KERNELS; ++k)
+            if (supported(kernels[k].name)) { active = k; break; }
+    }
+    return active;
+}
+
+const char *matcher_kernel(void) {
+    return kernels[pick()].name;
+}
+
+int matcher_use_kernel(const char *name) {
+    for (size_t k = 0; k < N_KERNELS; ++k)
+        if (strcmp(kernels[k].name, name) == 0 && supported(name)) {
+            active = k;
+            return 0;
+        }
+    return -1;
+}
+
+size_t matcher_mask(const matcher_t *m, char *text, size_t len) {
+    if (!m || m->n_words == 0 || len == 0) return 0;
+    return kernels[pick()].fn(m, text, len);
+}
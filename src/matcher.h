@@ -0,0 +1,34 @@
+/* matcher.h
+   Case-insensitive multi-word matcher used for profanity filtering.
+   A vectorised prefilter (Teddy-style nibble lookups on the first two
+   bytes of every word) rejects clean text 16 or 32 bytes at a time;
+   only candidate positions are verified. The kernel (AVX2, SSSE3 or
+   scalar) is picked once at runtime from the CPU's features.
+   Verification folds leetspeak, stretched letters, fullwidth letters and
+   zero-width characters, and honours per-word token boundaries.
+*/
+#ifndef MATCHER_H
+#define MATCHER_H
+
+#include <stddef.h>
+
+typedef struct matcher matcher_t;
+
+/* words are copied and normalised; empty words are ignored. A word
+   matches whole tokens only, unless it starts or ends with '*': "fuck*"
+   also matches inside "fucking", "*fuck*" anywhere. */
+matcher_t *matcher_new(const char *const *words, size_t n);
+void matcher_free(matcher_t *m);
+
+/* replace every occurrence of any word with '*', byte for byte, so the
+   length is unchanged (overlapping matches are masked as their union);
+   returns the number of matches */
+size_t matcher_mask(const matcher_t *m, char *text, size_t len);
+
+/* kernel in use: "avx2", "ssse3" or "scalar" */
+const char *matcher_kernel(void);
+
+/* force a kernel (benchmarks, testing); returns -1 if the CPU lacks it */
+int matcher_use_kernel(const char *name);
+
+#endif
@@ -0,0 +1,217 @@
+/* metrics.c
+   Per-thread metric shards. A shard is only ever written by its owning
+   thread, so updates are a relaxed load and store (no lock prefix);
+   readers use relaxed loads and may see a value that is a moment old.
+   Shards are pushed onto a lock-free list on first use and never freed.
+*/
+#include "metrics.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    _Atomic uint64_t count, sum, max;
+    _Atomic uint64_t buckets[HIST_BUCKETS];
+} shard_hist_t;
+
+typedef struct shard {
+    _Atomic uint64_t counters[M_COUNTER_COUNT];
+    shard_hist_t hist[H_HISTOGRAM_COUNT];
+    struct shard *next;
+} shard_t;
+
+static _Atomic(shard_t *) shards = NULL;
+static __thread shard_t *local_shard = NULL;
+
+static const char *counter_names[M_COUNTER_COUNT] = {
+    [M_MSGS_ROUTED] = "messages_routed",
+    [M_PMS_ROUTED] = "private_messages",
+    [M_BYTES_IN] = "bytes_in",
+    [M_BYTES_OUT] = "bytes_out",
+    [M_DROPS] = "output_drops",
+    [M_ACCEPTS] = "accepts",
+    [M_DISCONNECTS] = "disconnects",
+    [M_HISTORY_READS] = "history_reads",
+    [M_FILTER_CACHE_HITS] = "filter_cache_hits",
+    [M_FILTER_CACHE_MISSES] = "filter_cache_misses",
+    [M_BUS_OUT] = "bus_frames_out",
+    [M_BUS_IN] = "bus_frames_in",
+    [M_BUS_DROPS] = "bus_drops",
+    [M_PEER_OUT] = "peer_frames_out",
+    [M_PEER_IN] = "peer_frames_in",
+    [M_PEER_WRITES] = "peer_writes",
+    [M_PEER_DROPS] = "peer_drops",
+    [M_ADMIT_WAITS] = "admit_waits",
+    [M_ADMIT_REJECTS] = "admit_rejects",
+    [M_RATE_SHED_USER] = "rate_shed_user",
+    [M_RATE_SHED_ROOM] = "rate_shed_room",
+    [M_PINGS] = "pings_sent",
+    [M_IDLE_DISCONNECTS] = "idle_disconnects",
+    [M_PRESENCE_EVENTS] = "presence_events",
+    [M_PRESENCE_LINES] = "presence_lines",
+};
+
+static const char *histogram_names[H_HISTOGRAM_COUNT] = {
+    [H_ROUTE_NS] = "route_ns",
+    [H_FILTER_NS] = "filter_ns",
+    [H_LOG_WRITE_NS] = "log_write_ns",
+    [H_FANOUT] = "fanout_recipients",
+};
+
+static shard_t *shard(void) {
+    if (local_shard) return local_shard;
+    shard_t *s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    s->next = atomic_load(&shards);
+    while (!atomic_compare_exchange_weak(&shards, &s->next, s)) {}
+    local_shard = s;
+    return s;
+}
+
+/* single-writer increment: no read-modify-write atomic needed */
+static inline void bump(_Atomic uint64_t *p, uint64_t v) {
+    atomic_store_explicit(p, atomic_load_explicit(p, memory_order_relaxed) + v,
+                          memory_order_relaxed);
+}
+
+static inline unsigned hist_index(uint64_t v) {
+    if (v < (1u << HIST_SUB_BITS)) return (unsigned)v;
+    unsigned e = 63 - __builtin_clzll(v);
+    unsigned sub = (v >> (e - HIST_SUB_BITS)) & ((1u << HIST_SUB_BITS) - 1);
+    return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + sub;
+}
+
+/* largest value that falls into bucket idx */
+static uint64_t hist_bucket_top(unsigned idx) {
+    if (idx < (1u << HIST_SUB_BITS)) return idx;
+    unsigned e = (idx >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    uint64_t sub = idx & ((1u << HIST_SUB_BITS) - 1);
+    uint64_t low = (1ull << e) | (sub << (e - HIST_SUB_BITS));
+    return low + (1ull << (e - HIST_SUB_BITS)) - 1;
+}
+
+void metric_add(metric_counter_t c, uint64_t v) {
+    shard_t *s = shard();
+    if (s) bump(&s->counters[c], v);
+}
+
+void metric_record(metric_histogram_t h, uint64_t v) {
+    shard_t *s = shard();
+    if (!s) return;
+    shard_hist_t *sh = &s->hist[h];
+    bump(&sh->count, 1);
+    bump(&sh->sum, v);
+    bump(&sh->buckets[hist_index(v)], 1);
+    if (v > atomic_load_explicit(&sh->max, memory_order_relaxed))
+        atomic_store_explicit(&sh->max, v, memory_order_relaxed);
+}
+
+void metrics_collect(metrics_snapshot_t *out) {
+    memset(out, 0, sizeof(*out));
+    for (shard_t *s = atomic_load(&shards); s; s = s->next) {
+        for (int c = 0; c < M_COUNTER_COUNT; ++c)
+            out->counters[c] += atomic_load_explicit(&s->counters[c], memory_order_relaxed);
+        for (int h = 0; h < H_HISTOGRAM_COUNT; ++h) {
+            histogram_t *d = &out->hist[h];
+            shard_hist_t *sh = &s->hist[h];
+            d->count += atomic_load_explicit(&sh->count, memory_order_relaxed);
+            d->sum += atomic_load_explicit(&sh->sum, memory_order_relaxed);
+            uint64_t mx = atomic_load_explicit(&sh->max, memory_order_relaxed);
+            if (mx > d->max) d->max = mx;
+            for (int b = 0; b < HIST_BUCKETS; ++b)
+                d->buckets[b] += atomic_load_explicit(&sh->buckets[b], memory_order_relaxed);
+        }
+    }
+}
+
+uint64_t hist_percentile(const histogram_t *h, double p) {
+    uint64_t total = 0;
+    for (int b = 0; b < HIST_BUCKETS; ++b) total += h->buckets[b];
+    if (total == 0) return 0;
+    uint64_t rank = (uint64_t)(p * total);
+    if (rank >= total) rank = total - 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; ++b) {
+        seen += h->buckets[b];
+        if (seen > rank) {
+            uint64_t top = hist_bucket_top(b);
+            return top < h->max ? top : h->max;
+        }
+    }
+    return h->max;
+}
+
+const char *metric_counter_name(metric_counter_t c) {
+    return counter_names[c];
+}
+
+const char *metric_histogram_name(metric_histogram_t h) {
+    return histogram_names[h];
+}
+
+uint64_t metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+size_t metrics_format(const metrics_snapshot_t *s, char *buf, size_t cap) {
+    size_t off = 0;
+#define OUT(...) do { \
+        int n_ = snprintf(buf + off, off < cap ? cap - off : 0, __VA_ARGS__); \
+        if (n_ > 0) off += (size_t)n_; \
+    } while (0)
+    for (int c = 0; c < M_COUNTER_COUNT; ++c)
+        OUT("%-18s %llu\n", counter_names[c], (unsigned long long)s->counters[c]);
+    for (int h = 0; h < H_HISTOGRAM_COUNT; ++h) {
+        const histogram_t *hg = &s->hist[h];
+        OUT("%-18s count=%llu avg=%llu p50=%llu p90=%llu p99=%llu max=%llu\n",
+            histogram_names[h], (unsigned long long)hg->count,
+            (unsigned long long)(hg->count ? hg->sum / hg->count : 0),
+            (unsigned long long)hist_percentile(hg, 0.50),
+            (unsigned long long)hist_percentile(hg, 0.90),
+            (unsigned long long)hist_percentile(hg, 0.99),
+            (unsigned long long)hg->max);
+    }
+#undef OUT
+    return off < cap ? off : (cap ? cap - 1 : 0);
+}
+
+size_t metrics_format_prometheus(const metrics_snapshot_t *s, const char *prefix,
+                                 char *buf, size_t cap) {
+    size_t off = 0;
+#define OUT(...) do { \
+        int n_ = snprintf(buf + off, off < cap ? cap - off : 0, __VA_ARGS__); \
+        if (n_ > 0) off += (size_t)n_; \
+    } while (0)
+    for (int c = 0; c < M_COUNTER_COUNT; ++c) {
+        OUT("# TYPE %s_%s_total counter\n", prefix, counter_names[c]);
+        OUT("%s_%s_total %llu\n", prefix, counter_names[c],
+            (unsigned long long)s->counters[c]);
+    }
+    for (int h = 0; h < H_HISTOGRAM_COUNT; ++h) {
+        const histogram_t *hg = &s->hist[h];
+        const char *name = histogram_names[h];
+        OUT("# TYPE %s_%s histogram\n", prefix, name);
+        /* fold the log-linear buckets into one "le" per power of two; bucket
+           boundaries align there, so the cumulative counts are exact
+           (le is reported as the inclusive top, 2^k - 1) */
+        uint64_t cum = 0;
+        int b = 0;
+        for (unsigned e = 0; e < 64; ++e) {
+            uint64_t top = (2ull << e) - 1;
+            while (b < HIST_BUCKETS && hist_bucket_top(b) <= top) cum += hg->buckets[b++];
+            OUT("%s_%s_bucket{le=\"%llu\"} %llu\n", prefix, name,
+                (unsigned long long)top, (unsigned long long)cum);
+            if (top >= hg->max) break; /* series only ever grow with max */
+        }
+        OUT("%s_%s_bucket{le=\"+Inf\"} %llu\n", prefix, name, (unsigned long long)hg->count);
+        OUT("%s_%s_sum %llu\n", prefix, name, (unsigned long long)hg->sum);
+        OUT("%s_%s_count %llu\n", prefix, name, (unsigned long long)hg->count);
+    }
+#undef OUT
+    return off < cap ? off : (cap ? cap - 1 : 0);
+}
@@ -0,0 +1,85 @@
+/* metrics.h
+   Server-wide metrics registry. Every thread that records a metric gets
+   its own shard of counters and histograms, written without locks or
+   read-modify-write atomics (a shard has exactly one writer). Readers
+   aggregate all shards on demand.
+*/
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    M_MSGS_ROUTED,   /* room messages fanned out */
+    M_PMS_ROUTED,    /* private messages delivered */
+    M_BYTES_IN,      /* bytes read from connection children */
+    M_BYTES_OUT,     /* bytes handed to connection children */
+    M_DROPS,         /* output dropped because a client queue was full */
+    M_ACCEPTS,
+    M_DISCONNECTS,
+    M_HISTORY_READS,
+    M_FILTER_CACHE_HITS,   /* messages answered by filtercache */
+    M_FILTER_CACHE_MISSES, /* cacheable messages that ran the matcher */
+    M_BUS_OUT,       /* frames sent to other shards */
+    M_BUS_IN,        /* frames received from other shards */
+    M_BUS_DROPS,     /* frames a shard could not queue */
+    M_PEER_OUT,      /* frames queued for federated servers */
+    M_PEER_IN,       /* frames received from federated servers */
+    M_PEER_WRITES,   /* write() calls on peer links; out/writes is the batching */
+    M_PEER_DROPS,    /* frames a peer link could not queue */
+    M_ADMIT_WAITS,   /* accept passes cut short by the admission rate */
+    M_ADMIT_REJECTS, /* connections turned away with a retry hint */
+    M_RATE_SHED_USER, /* messages over their sender's rate limit */
+    M_RATE_SHED_ROOM, /* messages over their room's rate limit */
+    M_PINGS,          /* keepalive PINGs sent to quiet connections */
+    M_IDLE_DISCONNECTS,
+    M_PRESENCE_EVENTS, /* joins and leaves... */
+    M_PRESENCE_LINES,  /* ...and the announcements they were folded into */
+    M_COUNTER_COUNT
+} metric_counter_t;
+
+typedef enum {
+    H_ROUTE_NS,      /* MSG frame handling in the parent, end to end */
+    H_FILTER_NS,     /* profanity filter */
+    H_LOG_WRITE_NS,  /* append_room_log() */
+    H_FANOUT,        /* recipients per broadcast */
+    H_HISTOGRAM_COUNT
+} metric_histogram_t;
+
+/* log-linear buckets: 16 sub-buckets per power of two (~6% error) */
+#define HIST_SUB_BITS 4
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+typedef struct {
+    uint64_t count, sum, max;
+    uint64_t buckets[HIST_BUCKETS];
+} histogram_t;
+
+typedef struct {
+    uint64_t counters[M_COUNTER_COUNT];
+    histogram_t hist[H_HISTOGRAM_COUNT];
+} metrics_snapshot_t;
+
+void metric_add(metric_counter_t c, uint64_t v);
+void metric_record(metric_histogram_t h, uint64_t v);
+
+/* sum of every thread's shard */
+void metrics_collect(metrics_snapshot_t *out);
+
+uint64_t hist_percentile(const histogram_t *h, double p);
+
+const char *metric_counter_name(metric_counter_t c);
+const char *metric_histogram_name(metric_histogram_t h);
+
+uint64_t metrics_now_ns(void);
+
+/* human readable dump of a snapshot; returns bytes written */
+size_t metrics_format(const metrics_snapshot_t *s, char *buf, size_t cap);
+
+/* Prometheus text exposition (counters and cumulative histograms), every
+   series named <prefix>_<metric>; returns bytes written */
+size_t metrics_format_prometheus(const metrics_snapshot_t *s, const char *prefix,
+                                 char *buf, size_t cap);
+
+#endif
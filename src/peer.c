@@ -0,0 +1,372 @@
+/* peer.c
+   Links live in a fixed table. Outgoing ones keep their slot and address
+   while down and cycle IDLE -> CONNECTING -> HELLO -> UP; accepted ones
+   free their slot when they drop. Of two links between the same pair of
+   nodes, the one opened by the node with the lower id survives, which
+   both sides can work out on their own from the HELLOs.
+*/
+#define _GNU_SOURCE
+#include "peer.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PEER_OUT_MAX (4 * 1024 * 1024) /* queued bytes per link */
+#define PEER_RETRY_SEC 2
+#define PEER_HELLO_TIMEOUT 5
+
+typedef enum { L_FREE, L_IDLE, L_CONNECTING, L_HELLO, L_UP } link_state_t;
+
+typedef struct {
+    link_state_t state;
+    int fd;
+    bool outgoing;
+    struct sockaddr_in addr; /* outgoing: where to connect */
+    char name[64];
+    uint64_t remote_id;      /* from HELLO; kept while an outgoing link is down */
+    time_t next_try, since;
+    char in[PEER_FRAME_MAX];
+    size_t in_len;
+    char *out;
+    size_t out_len, out_cap;
+} link_t;
+
+static link_t links[PEER_MAX];
+static int peer_listen_fd = -1;
+static char listen_spec[64];
+static uint64_t self_id = 0;
+static peer_state_fn state_cb = NULL; /* from peer_handle, for flush errors */
+
+static int parse_addr(const char *spec, struct sockaddr_in *sin) {
+    char host[64] = "127.0.0.1";
+    const char *port = spec;
+    const char *colon = strrchr(spec, ':');
+    if (colon) {
+        size_t hl = colon - spec;
+        if (hl >= sizeof(host)) return -1;
+        memcpy(host, spec, hl);
+        host[hl] = '\0';
+        port = colon + 1;
+    }
+    memset(sin, 0, sizeof(*sin));
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons(atoi(port));
+    return inet_pton(AF_INET, host, &sin->sin_addr) == 1 && sin->sin_port ? 0 : -1;
+}
+
+static void ensure_id(void) {
+    if (self_id) return;
+    if (getrandom(&self_id, sizeof(self_id), 0) != sizeof(self_id))
+        self_id = (uint64_t)time(NULL) << 32 ^ (uint64_t)getpid();
+    if (!self_id) self_id = 1;
+}
+
+static int open_listener(void) {
+    struct sockaddr_in sin;
+    if (parse_addr(listen_spec, &sin) < 0) return -1;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 || listen(fd, PEER_MAX) < 0) {
+        close(fd);
+        return -1;
+    }
+    peer_listen_fd = fd;
+    return 0;
+}
+
+int peer_listen(const char *spec) {
+    if (strlen(spec) >= sizeof(listen_spec)) return -1;
+    ensure_id();
+    strcpy(listen_spec, spec);
+    return open_listener();
+}
+
+int peer_add(const char *spec) {
+    ensure_id();
+    for (int k = 0; k < PEER_MAX; ++k) {
+        link_t *l = &links[k];
+        if (l->state != L_FREE) continue;
+        if (parse_addr(spec, &l->addr) < 0) return -1;
+        snprintf(l->name, sizeof(l->name), "%s", spec);
+        l->outgoing = true;
+        l->fd = -1;
+        l->remote_id = 0;
+        l->next_try = 0;
+        l->state = L_IDLE;
+        return 0;
+    }
+    return -1;
+}
+
+static void queue(link_t *l, const char *data, size_t len) {
+    if (l->out_len + len > l->out_cap) {
+        size_t cap = l->out_cap ? l->out_cap : 4096;
+        while (cap < l->out_len + len) cap *= 2;
+        char *nb = realloc(l->out, cap);
+        if (!nb) return;
+        l->out = nb;
+        l->out_cap = cap;
+    }
+    memcpy(l->out + l->out_len, data, len);
+    l->out_len += len;
+}
+
+static void link_reset(link_t *l) {
+    if (l->fd >= 0) close(l->fd);
+    l->fd = -1;
+    free(l->out);
+    l->out = NULL;
+    l->out_len = l->out_cap = 0;
+    l->in_len = 0;
+    if (l->outgoing) {
+        l->state = L_IDLE;
+        l->next_try = time(NULL) + PEER_RETRY_SEC;
+    } else {
+        l->state = L_FREE;
+    }
+}
+
+static void link_down(int k) {
+    bool was_up = links[k].state == L_UP;
+    link_reset(&links[k]);
+    if (was_up) {
+        fprintf(stderr, "peer %s: link lost\n", links[k].name);
+        if (state_cb) state_cb(k, false);
+    }
+}
+
+static void link_established(link_t *l) {
+    char hello[64];
+    int n = snprintf(hello, sizeof(hello), "HELLO|%016llx\n", (unsigned long long)self_id);
+    queue(l, hello, n);
+    l->state = L_HELLO;
+    l->since = time(NULL);
+}
+
+static void try_connect(link_t *l) {
+    l->next_try = time(NULL) + PEER_RETRY_SEC;
+    l->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (l->fd < 0) return;
+    if (connect(l->fd, (struct sockaddr *)&l->addr, sizeof(l->addr)) == 0) {
+        link_established(l);
+    } else if (errno == EINPROGRESS) {
+        l->state = L_CONNECTING;
+        l->since = time(NULL);
+    } else {
+        close(l->fd);
+        l->fd = -1;
+    }
+}
+
+static bool node_up(uint64_t id) {
+    for (int k = 0; k < PEER_MAX; ++k)
+        if (links[k].state == L_UP && links[k].remote_id == id) return true;
+    return false;
+}
+
+/* the node that opened link l */
+static uint64_t opener(const link_t *l) {
+    return l->outgoing ? self_id : l->remote_id;
+}
+
+static void handle_hello(int k, const char *frame) {
+    link_t *l = &links[k];
+    uint64_t id = strtoull(frame + 6, NULL, 16);
+    if (id == 0 || id == self_id) {
+        fprintf(stderr, "peer %s: %s, giving up\n", l->name, id ? "that is this server" : "bad HELLO");
+        bool outgoing = l->outgoing;
+        link_reset(l);
+        if (outgoing) l->state = L_FREE;
+        return;
+    }
+    l->remote_id = id;
+    uint64_t lo = id < self_id ? id : self_id;
+    for (int j = 0; j < PEER_MAX; ++j) {
+        if (j == k || links[j].state != L_UP || links[j].remote_id != id) continue;
+        if (opener(l) == lo && opener(&links[j]) != lo) {
+            link_down(j); /* the new link is the keeper */
+        } else {
+            link_reset(l);
+            return;
+        }
+    }
+    l->state = L_UP;
+    fprintf(stderr, "peer %s: up\n", l->name);
+    state_cb(k, true);
+}
+
+static void read_link(int k, peer_frame_fn on_frame) {
+    link_t *l = &links[k];
+    ssize_t n = read(l->fd, l->in + l->in_len, sizeof(l->in) - 1 - l->in_len);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) return;
+    if (n <= 0) {
+        link_down(k);
+        return;
+    }
+    l->in_len += n;
+    size_t pos = 0;
+    while (l->state >= L_HELLO && pos < l->in_len) {
+        char *start = l->in + pos;
+        char *nl = memchr(start, '\n', l->in_len - pos);
+        if (!nl) break;
+        size_t len = nl - start;
+        *nl = '\0';
+        pos += len + 1;
+        if (l->state == L_HELLO) {
+            if (strncmp(start, "HELLO|", 6) == 0) handle_hello(k, start);
+            else link_down(k);
+        } else {
+            on_frame(k, start, len);
+        }
+    }
+    if (l->state < L_HELLO) return;
+    if (pos == 0 && l->in_len == sizeof(l->in) - 1) {
+        fprintf(stderr, "peer %s: frame too long\n", l->name);
+        link_down(k);
+        return;
+    }
+    memmove(l->in, l->in + pos, l->in_len - pos);
+    l->in_len -= pos;
+}
+
+static unsigned flush_link(int k) {
+    link_t *l = &links[k];
+    unsigned writes = 0;
+    size_t off = 0;
+    while (off < l->out_len) {
+        ssize_t w = write(l->fd, l->out + off, l->out_len - off);
+        writes++;
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) break;
+            link_down(k);
+            return writes;
+        }
+        off += w;
+    }
+    memmove(l->out, l->out + off, l->out_len - off);
+    l->out_len -= off;
+    return writes;
+}
+
+void peer_fds(fd_set *rfds, fd_set *wfds, int *maxfd) {
+    if (peer_listen_fd >= 0) {
+        FD_SET(peer_listen_fd, rfds);
+        if (peer_listen_fd > *maxfd) *maxfd = peer_listen_fd;
+    }
+    for (int k = 0; k < PEER_MAX; ++k) {
+        link_t *l = &links[k];
+        if (l->fd < 0 || l->state < L_CONNECTING) continue;
+        if (l->state == L_CONNECTING || l->out_len > 0) FD_SET(l->fd, wfds);
+        if (l->state != L_CONNECTING) FD_SET(l->fd, rfds);
+        if (l->fd > *maxfd) *maxfd = l->fd;
+    }
+}
+
+static void handle_accept(void) {
+    struct sockaddr_in sin;
+    socklen_t sl = sizeof(sin);
+    int fd = accept4(peer_listen_fd, (struct sockaddr *)&sin, &sl, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) return;
+    for (int k = 0; k < PEER_MAX; ++k) {
+        link_t *l = &links[k];
+        if (l->state != L_FREE) continue;
+        char ip[INET_ADDRSTRLEN] = "?";
+        inet_ntop(AF_INET, &sin.sin_addr, ip, sizeof(ip));
+        snprintf(l->name, sizeof(l->name), "%s:%d", ip, ntohs(sin.sin_port));
+        l->outgoing = false;
+        l->fd = fd;
+        l->remote_id = 0;
+        link_established(l);
+        return;
+    }
+    close(fd); /* table full */
+}
+
+void peer_handle(fd_set *rfds, fd_set *wfds, peer_frame_fn on_frame, peer_state_fn on_state) {
+    state_cb = on_state;
+    if (peer_listen_fd >= 0 && FD_ISSET(peer_listen_fd, rfds)) handle_accept();
+    time_t now = time(NULL);
+    for (int k = 0; k < PEER_MAX; ++k) {
+        link_t *l = &links[k];
+        switch (l->state) {
+        case L_IDLE:
+            /* an outgoing link that lost a duplicate race waits while the
+               other one is up */
+            if (now >= l->next_try && !(l->remote_id && node_up(l->remote_id))) try_connect(l);
+            break;
+        case L_CONNECTING:
+            if (FD_ISSET(l->fd, wfds)) {
+                int err = 0;
+                socklen_t el = sizeof(err);
+                getsockopt(l->fd, SOL_SOCKET, SO_ERROR, &err, &el);
+                if (err) link_reset(l);
+                else link_established(l);
+            } else if (now - l->since > PEER_HELLO_TIMEOUT) {
+                link_reset(l);
+            }
+            break;
+        case L_HELLO:
+        case L_UP:
+            if (FD_ISSET(l->fd, rfds)) read_link(k, on_frame);
+            if (l->state == L_HELLO && now - l->since > PEER_HELLO_TIMEOUT) link_reset(l);
+            if (l->state >= L_HELLO && FD_ISSET(l->fd, wfds)) flush_link(k);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+bool peer_up(int link) {
+    return link >= 0 && link < PEER_MAX && links[link].state == L_UP;
+}
+
+const char *peer_name(int link) {
+    return links[link].name;
+}
+
+bool peer_send(int link, const char *frame, size_t len) {
+    if (!peer_up(link)) return false;
+    link_t *l = &links[link];
+    if (l->out_len + len + 1 > PEER_OUT_MAX) return false;
+    size_t before = l->out_len;
+    queue(l, frame, len);
+    queue(l, "\n", 1);
+    if (l->out_len != before + len + 1) {
+        l->out_len = before; /* out of memory: drop the whole frame */
+        return false;
+    }
+    return true;
+}
+
+unsigned peer_flush(void) {
+    unsigned writes = 0;
+    for (int k = 0; k < PEER_MAX; ++k)
+        if (links[k].state >= L_HELLO && links[k].out_len > 0) writes += flush_link(k);
+    return writes;
+}
+
+void peer_close(void) {
+    if (peer_listen_fd >= 0) close(peer_listen_fd);
+    peer_listen_fd = -1;
+    for (int k = 0; k < PEER_MAX; ++k)
+        if (links[k].state != L_FREE && links[k].state != L_IDLE) link_reset(&links[k]);
+}
+
+int peer_reopen(void) {
+    for (int k = 0; k < PEER_MAX; ++k)
+        if (links[k].state == L_IDLE) links[k].next_try = 0;
+    return listen_spec[0] ? open_listener() : 0;
+}
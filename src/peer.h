@@ -0,0 +1,51 @@
+/* peer.h
+   TCP links to other chat servers, driven by the server's select() loop.
+   Frames are single lines. A link is usable once both ends have
+   exchanged HELLO with their node ids; when two servers end up with two
+   links to each other (each listed the other), one is dropped, the same
+   one on both sides. Outgoing links are retried every few seconds while
+   down. Sends are only queued; peer_flush() writes each link's batch.
+*/
+#ifndef PEER_H
+#define PEER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/select.h>
+
+#define PEER_MAX 16
+#define PEER_FRAME_MAX (64 * 1024)
+
+/* frame without its newline, NUL-terminated */
+typedef void (*peer_frame_fn)(int link, char *frame, size_t len);
+/* a link finished its HELLO (up) or was lost after it had (down) */
+typedef void (*peer_state_fn)(int link, bool up);
+
+/* accept peers on "port" or "host:port" (host defaults to 127.0.0.1) */
+int peer_listen(const char *spec);
+
+/* keep a link to the server at "port" or "host:port" */
+int peer_add(const char *spec);
+
+/* add the listener and links to the select sets */
+void peer_fds(fd_set *rfds, fd_set *wfds, int *maxfd);
+
+/* accept, connect, read frames and retry lost links */
+void peer_handle(fd_set *rfds, fd_set *wfds, peer_frame_fn on_frame, peer_state_fn on_state);
+
+bool peer_up(int link);
+const char *peer_name(int link);
+
+/* queue a frame (no newline) on an up link; false if it is not up or
+   its backlog is full */
+bool peer_send(int link, const char *frame, size_t len);
+
+/* write out every link's queued frames; returns write() calls made */
+unsigned peer_flush(void);
+
+/* close the listener and every link without callbacks (forked children,
+   hot restart); peer_reopen() listens again and retries outgoing links */
+void peer_close(void);
+int peer_reopen(void);
+
+#endif
@@ -1,7 +1,7 @@
 /* server.c
    Multi-client chat server (fork-per-connection) with:
-   - rooms, history (logs/<room>.log)
-   - /nick, /join, /rooms, /history, /pm, /admin, /quit
+   - rooms, history (logs/<room>.log, older lines in compressed segments)
+   - /nick, /join, /rooms, /history, /search, /pm, /admin, /quit
    - profanity filter via fork()+exec() -> ./filter
    - uses pipes, fork, exec, wait, select, open, read, write, signals
 */
@@ -9,6 +9,7 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <netinet/in.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -16,495 +17,2213 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
 #include <sys/select.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "bus.h"
+#include "httpd.h"
+#include "peer.h"
+#include "tbucket.h"
+#include "twheel.h"
+#include "intern.h"
+#include "logstore.h"
+#include "commands.h"
+#include "config.h"
+#include "flightrec.h"
+#include "metrics.h"
+#include "filtercache.h"
+#include "filterpool.h"
+#include "handoff.h"
+#include "trace.h"
+#include "wordfilter.h"
+
 /* ------------ CONSTANTS ------------ */
+/* defaults for settings that can be changed in the config file or on the
+   command line (see usage()) */
 #define PORT 12345
-#define BACKLOG 10
-#define BUF 8192
-#define MAX_CLIENTS 128
-#define MAX_ROOMS 128
+#define BACKLOG 4096 /* the kernel caps it at net.core.somaxconn */
+#define BUF 8192     /* longest line a connection may send */
+#define MAX_CLIENTS 256
+#define MAX_ROOMS 256
 #define LOGDIR "logs"
 #define ADMIN_PASSWORD "admin123"
+#define CONFIG_PATH "server.conf" /* read when present unless --config says otherwise */
+#define ACCEPT_BUDGET 64 /* connections accepted per loop pass */
+#define ACCEPT_RATE 200  /* new connections admitted per second */
+#define RETRY_HINT_MAX_MS 60000
+#define USER_MSGS 5          /* per connection, messages per second */
+#define USER_BYTES 16384     /* per connection, bytes per second */
+#define ROOM_MSGS 100        /* per room */
+#define ROOM_BYTES (256 * 1024)
+#define RATE_BURST 2         /* seconds of rate a bucket can save up */
+#define KEEPALIVE_SECS 30    /* silence before the server sends PING */
+#define IDLE_TIMEOUT_SECS 90 /* silence before the connection is dropped */
+#define PRESENCE_BATCH 50    /* members from which joins and leaves are coalesced */
+#define PRESENCE_WINDOW_MS 1000
+#define HISTORY_PRELOAD 10   /* recent lines pushed on /join */
+#define HISTORY_PAGE 50      /* lines per /more */
+#define HISTORY_CACHE 200    /* recent lines kept in memory per room */
+#define HISTORY_WARM_BYTES (64 * 1024) /* hot log tail read to fill the cache */
+#define HOT_LOG_MAX (256 * 1024) /* hot log size before it is compressed */
+#define SEARCH_MAX_RESULTS 100
+#define ARENA_INITIAL (256 * 1024)
+#define POOL_SLAB_SIZE (256 * 1024)
+#define OUTQ_MAX (1024 * 1024) /* bytes queued for a slow client before dropping */
+#define FILTER_OFFLOAD_MIN 256  /* messages this long are filtered on the pool */
 
 /* ------------ DATA STRUCTURES ------------ */
+/* messages and bytes per second, 0 for no limit */
+typedef struct {
+    unsigned msgs, bytes;
+} rate_limit_t;
+
+typedef struct {
+    tbucket_t msgs, bytes;
+    rate_limit_t limit;
+    bool custom;   /* set by an admin: kept when the defaults change */
+    uint64_t shed; /* messages dropped by this limiter */
+} limiter_t;
+
+/* queued output for a child pipe that would block; lives in a pool buffer */
+typedef struct outseg {
+    struct outseg *next;
+    size_t off, len;
+    char data[];
+} outseg_t;
+
+/* The connection table is split by access pattern. Fields read for every
+   recipient of a fan-out or on every event-loop pass live in dense
+   parallel arrays indexed by slot (conn_*), so scanning the table touches
+   a handful of cache lines. Everything else is cold metadata in
+   client_t, only looked at for the connection being served. */
+static bool *conn_live;    /* slot in use */
+static atom_t *conn_room;  /* interned room name */
+static int *conn_ri;       /* conn_room's index in rooms[], -1 if not listed */
+static int *conn_out_fd;   /* pipe to the child; non-blocking */
+static int *conn_in_fd;    /* pipe from the child */
+static bool *conn_queued;  /* output is waiting in the out queue */
+
 typedef struct {
     pid_t pid;
-    int to_child_fd;
-    int from_child_fd;
-    char username[64];
-    char room[64];
-    bool connected;
+    atom_t user;       /* interned username, ATOM_NONE until /nick or /join */
     bool muted;
     bool is_admin; /* true when this client authenticated as admin */
+    char *in_buf;      /* partial frame from the child, pool buffer or NULL */
+    size_t in_len, in_cap;
+    outseg_t *out_head, *out_tail;
+    size_t out_bytes;
+    uint64_t trace_recv_ns; /* from the child's TS frame, for the next MSG */
+    uint32_t pm_seq;        /* PM being looked up on other shards... */
+    unsigned pm_waiting;    /* ...and how many have yet to answer */
+    limiter_t limiter;      /* this connection's message rate */
+    bool throttle_noticed;  /* told about the current run of drops */
+    uint64_t last_active_ms, last_ping_ms;
+    int hist_room;          /* room the /more cursor is in, or -1 */
+    uint64_t hist_skip;     /* newest lines of it already shown... */
+    uint64_t hist_mark;     /* ...counted back from its recent.total then */
+    twheel_timer_t idle_timer;  /* keepalive and idle checks */
+    twheel_timer_t rate_timer;  /* "you can send again" after drops */
+    /* last appeal message, to avoid duplicate forwards */
+    char last_appeal[512];
 } client_t;
 
-static client_t clients[MAX_CLIENTS];
-static char rooms[MAX_ROOMS][64];
+/* clients[] is the slab for connection records; free slots are kept on
+   a stack so accept and close are O(1) */
+static client_t *clients;
+static int *free_slots;
+static int free_top = 0;
+static atom_t *rooms;
+static uint64_t *room_msgs;   /* messages routed, parallel to rooms[] */
+static uint32_t *room_shards; /* rooms we own: other shards with members */
+static limiter_t *room_limiters; /* message rate per room, parallel to rooms[] */
+
+/* joins and leaves not yet announced; parallel to rooms[] */
+typedef struct {
+    unsigned joined, left;
+    twheel_timer_t timer; /* armed while a batch is collecting */
+} presence_t;
+static presence_t *room_presence_batch;
+
+/* the newest logged lines of a room, for /join and /more; parallel to rooms[] */
+typedef struct {
+    char *text; /* a pool buffer, kept and refilled as the ring turns */
+    size_t len, cap;
+} recent_slot_t;
+
+typedef struct {
+    recent_slot_t *slots; /* ring of history_cache lines, allocated on first use */
+    unsigned head, count;
+    uint64_t total;  /* lines added since the room was created here */
+} recent_t;
+static recent_t *room_recent;
 static int room_count = 0;
-/* per-client last appeal message to avoid duplicate forwards */
-static char last_appeal_msg[MAX_CLIENTS][512];
+static atom_t global_room = ATOM_NONE; /* "global": broadcast to everyone */
+
+/* stage stamps for the room message being routed, when it was sampled */
+static trace_rec_t cur_trace;
+static bool tracing = false;
 
 static volatile sig_atomic_t shutdown_requested = 0;
 static int listen_fd = -1;
 
+/* settings, fixed once startup has read the config file and flags */
+static const char *bind_addr = "0.0.0.0";
+static int chat_port = PORT;
+static int listen_backlog = BACKLOG;
+static size_t line_max = BUF;
+static int max_clients = MAX_CLIENTS;
+static int max_rooms = MAX_ROOMS;
+static const char *logdir = LOGDIR;
+static const char *admin_password = ADMIN_PASSWORD;
+static unsigned accept_budget = ACCEPT_BUDGET;
+static unsigned accept_rate = ACCEPT_RATE;
+static unsigned accept_burst = 0;   /* 0: twice the rate */
+static bool accept_reject = false;  /* over the rate: turn away instead of queueing */
+static rate_limit_t user_limit = {USER_MSGS, USER_BYTES};
+static rate_limit_t room_limit = {ROOM_MSGS, ROOM_BYTES};
+static unsigned rate_burst = RATE_BURST;
+static unsigned keepalive = KEEPALIVE_SECS;       /* 0: no PINGs */
+static unsigned idle_timeout = IDLE_TIMEOUT_SECS; /* 0: never */
+static unsigned presence_batch = PRESENCE_BATCH;      /* 0: always coalesce */
+static unsigned presence_window = PRESENCE_WINDOW_MS;
+static unsigned history_preload = HISTORY_PRELOAD; /* 0: nothing on /join */
+static unsigned history_page = HISTORY_PAGE;
+static unsigned history_cache = HISTORY_CACHE;
+static uint64_t loop_ms; /* monotonic clock at the start of this loop pass */
+static const char *metrics_addr = NULL;
+static const char *handoff_path = NULL; /* -U: hot restart socket */
+static int handoff_fd = -1;
+
 /* ------------ HELPERS ------------ */
 static inline void trim_newline(char *s) {
     if (!s) return;
     s[strcspn(s, "\r\n")] = '\0';
 }
 
+/* s as a whole number in [lo, hi], or -1 */
+static long parse_num(const char *s, long lo, long hi) {
+    char *end;
+    long v = strtol(s, &end, 10);
+    return *s && !*end && v >= lo && v <= hi ? v : -1;
+}
+
+/* ------------ ARENA ------------ */
+/* Bump allocator for transient strings on the message path (filtered
+   text, formatted lines). Everything is released at once by arena_reset()
+   at the top of each event-loop iteration. An iteration that outgrows
+   the block spills into heap chunks, and the next reset resizes the block
+   so the steady state does no malloc/free at all. */
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    size_t pad; /* keep the payload 16-byte aligned */
+} arena_chunk_t;
+
+static struct {
+    char *base;
+    size_t used, cap;
+    size_t spill_bytes;
+    arena_chunk_t *spill;
+    unsigned long allocs;      /* allocations served */
+    unsigned long heap_allocs; /* malloc calls made by the arena itself */
+} arena;
+
+static void *arena_alloc(size_t n) {
+    n = (n + 15) & ~(size_t)15;
+    arena.allocs++;
+    if (arena.cap - arena.used >= n) {
+        void *p = arena.base + arena.used;
+        arena.used += n;
+        return p;
+    }
+    arena_chunk_t *c = malloc(sizeof(*c) + n);
+    if (!c) return NULL;
+    arena.heap_allocs++;
+    arena.spill_bytes += n;
+    c->next = arena.spill;
+    arena.spill = c;
+    return c + 1;
+}
+
+static void arena_reset(void) {
+    size_t need = arena.used + arena.spill_bytes;
+    while (arena.spill) {
+        arena_chunk_t *next = arena.spill->next;
+        free(arena.spill);
+        arena.spill = next;
+    }
+    if (need > arena.cap || !arena.base) {
+        size_t cap = arena.cap ? arena.cap : ARENA_INITIAL;
+        while (cap < need) cap *= 2;
+        char *nb = malloc(cap);
+        if (nb) {
+            free(arena.base);
+            arena.base = nb;
+            arena.cap = cap;
+            arena.heap_allocs++;
+        }
+    }
+    arena.used = 0;
+    arena.spill_bytes = 0;
+}
+
+/* format into the arena; *len gets the length without the terminator */
+static char *arena_vprintf(size_t *len, const char *fmt, va_list ap) {
+    va_list ap2;
+    va_copy(ap2, ap);
+    size_t room = arena.cap - arena.used;
+    int n = vsnprintf(arena.base + arena.used, room, fmt, ap);
+    char *s = NULL;
+    if (n >= 0 && (size_t)n < room) {
+        s = arena_alloc(n + 1); /* claims exactly what was written */
+    } else if (n >= 0 && (s = arena_alloc(n + 1))) {
+        vsnprintf(s, n + 1, fmt, ap2);
+    }
+    va_end(ap2);
+    if (s && len) *len = n;
+    return s;
+}
+
+static char *arena_printf(size_t *len, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    char *s = arena_vprintf(len, fmt, ap);
+    va_end(ap);
+    return s;
+}
+
+static char *arena_strdup(const char *str) {
+    size_t n = strlen(str);
+    char *s = arena_alloc(n + 1);
+    if (s) memcpy(s, str, n + 1);
+    return s;
+}
+
 ssize_t writef(int fd, const char *fmt, ...) {
-    char buf[BUF];
+    size_t n;
     va_list ap;
     va_start(ap, fmt);
-    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    char *s = arena_vprintf(&n, fmt, ap);
     va_end(ap);
-    if (n < 0) return -1;
-    return write(fd, buf, n);
+    if (!s) return -1;
+    return write(fd, s, n);
 }
 
 void ensure_logdir() {
     struct stat st;
-    if (stat(LOGDIR, &st) == -1)
-        mkdir(LOGDIR, 0755);
+    if (stat(logdir, &st) == -1)
+        mkdir(logdir, 0755);
+}
+
+static void limiter_set(limiter_t *l, rate_limit_t lim, bool custom);
+static void idle_start(int i);
+static void presence_fire(twheel_timer_t *t);
+static void presence_add(int ri, unsigned joined, unsigned left);
+static void recent_warm(int ri);
+
+/* index of room a in rooms[], or -1 */
+static int room_index(atom_t a) {
+    if (a != ATOM_NONE)
+        for (int i = 0; i < room_count; ++i)
+            if (rooms[i] == a) return i;
+    return -1;
+}
+
+/* returns the room's index in rooms[], or -1 if it could not be added */
+int add_room_if_missing(const char *r) {
+    if (!r || !r[0]) return -1;
+    int ri = room_index(intern_lookup(r));
+    if (ri >= 0) return ri;
+
+    if (room_count >= max_rooms) {
+        fprintf(stderr, "rooms: all %d in use, cannot add '%s'\n", max_rooms, r);
+        return -1;
+    }
+    atom_t a = intern(r); /* the room list holds its own reference */
+    if (a == ATOM_NONE) {
+        fprintf(stderr, "rooms: name table full (%u names), cannot add '%s'\n", atom_capacity(), r);
+        return -1;
+    }
+    room_msgs[room_count] = 0;
+    room_shards[room_count] = 0;
+    limiter_set(&room_limiters[room_count], room_limit, false);
+    room_presence_batch[room_count] =
+        (presence_t){.timer = {.fn = presence_fire, .arg = (void *)(intptr_t)room_count}};
+    rooms[room_count] = a;
+    for (int k = 0; k < max_clients; ++k) /* members that got here first */
+        if (conn_live[k] && conn_room[k] == a) conn_ri[k] = room_count;
+    recent_warm(room_count);
+    return room_count++;
+}
+
+/* ------------ BUFFER POOL ------------ */
+/* Size-classed buffers for connection I/O, carved out of mmap'd slabs so
+   connection churn never reaches malloc. Freed buffers go back to the
+   calling thread's free list for their class; slabs are never returned,
+   so the footprint stays flat at the high-water mark. */
+#define POOL_CLASSES 4
+static const size_t pool_class_size[POOL_CLASSES] = { 512, 2048, 4096, 16384 };
+
+typedef struct pool_buf { struct pool_buf *next; } pool_buf_t;
+
+static __thread pool_buf_t *pool_free[POOL_CLASSES];
+static unsigned long pool_slabs = 0;
+
+static int pool_class(size_t n) {
+    for (int c = 0; c < POOL_CLASSES; ++c)
+        if (n <= pool_class_size[c]) return c;
+    return -1;
+}
+
+/* returns a buffer of at least n bytes; *cap gets its real size */
+static void *pool_get(size_t n, size_t *cap) {
+    int c = pool_class(n);
+    if (c < 0) return NULL;
+    if (!pool_free[c]) {
+        char *slab = mmap(NULL, POOL_SLAB_SIZE, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (slab == MAP_FAILED) return NULL;
+        pool_slabs++;
+        for (size_t off = 0; off + pool_class_size[c] <= POOL_SLAB_SIZE; off += pool_class_size[c]) {
+            pool_buf_t *b = (pool_buf_t *)(slab + off);
+            b->next = pool_free[c];
+            pool_free[c] = b;
+        }
+    }
+    pool_buf_t *b = pool_free[c];
+    pool_free[c] = b->next;
+    *cap = pool_class_size[c];
+    return b;
+}
+
+static void pool_put(void *p, size_t cap) {
+    int c = pool_class(cap);
+    if (!p || c < 0) return;
+    pool_buf_t *b = p;
+    b->next = pool_free[c];
+    pool_free[c] = b;
+}
+
+/* ------------ CONNECTION I/O ------------ */
+#define OUTSEG_CAP 4096
+
+/* append to client i's out queue; false if the queue limit was hit */
+static bool outq_append(int i, const char *data, size_t len) {
+    client_t *c = &clients[i];
+    if (c->out_bytes + len > OUTQ_MAX) {
+        metric_add(M_DROPS, 1);
+        return false;
+    }
+    while (len > 0) {
+        outseg_t *t = c->out_tail;
+        size_t room = t ? OUTSEG_CAP - sizeof(*t) - (t->off + t->len) : 0;
+        if (room == 0) {
+            size_t cap;
+            t = pool_get(OUTSEG_CAP, &cap);
+            if (!t) { metric_add(M_DROPS, 1); return false; }
+            t->next = NULL;
+            t->off = t->len = 0;
+            if (c->out_tail) c->out_tail->next = t;
+            else c->out_head = t;
+            c->out_tail = t;
+            conn_queued[i] = true;
+            room = OUTSEG_CAP - sizeof(*t);
+        }
+        size_t n = len < room ? len : room;
+        memcpy(t->data + t->off + t->len, data, n);
+        t->len += n;
+        c->out_bytes += n;
+        data += n;
+        len -= n;
+    }
+    return true;
 }
 
-void add_room_if_missing(const char *r) {
-    if (!r || !r[0]) return;
-    for (int i = 0; i < room_count; ++i)
-        if (strcmp(rooms[i], r) == 0) return;
+/* write as much of the out queue as the pipe takes */
+static void client_flush(int i) {
+    client_t *c = &clients[i];
+    while (c->out_head) {
+        outseg_t *h = c->out_head;
+        ssize_t w = write(conn_out_fd[i], h->data + h->off, h->len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return; /* EAGAIN: wait for writability; errors surface on read */
+        }
+        h->off += w;
+        h->len -= w;
+        c->out_bytes -= w;
+        if (h->len > 0) return;
+        c->out_head = h->next;
+        if (!c->out_head) {
+            c->out_tail = NULL;
+            conn_queued[i] = false;
+        }
+        pool_put(h, OUTSEG_CAP);
+    }
+}
 
-    if (room_count < MAX_ROOMS) {
-        strncpy(rooms[room_count], r, sizeof(rooms[0]) - 1);
-        rooms[room_count][sizeof(rooms[0]) - 1] = '\0';
-        room_count++;
+/* send to client i without ever blocking the server */
+static bool client_send(int i, const char *data, size_t len) {
+    metric_add(M_BYTES_OUT, len);
+    if (!conn_queued[i]) {
+        ssize_t w = write(conn_out_fd[i], data, len);
+        if (w == (ssize_t)len) return true;
+        if (w > 0) { data += w; len -= w; }
     }
+    return outq_append(i, data, len);
+}
+
+static bool client_printf(int i, const char *fmt, ...) {
+    size_t n;
+    va_list ap;
+    va_start(ap, fmt);
+    char *s = arena_vprintf(&n, fmt, ap);
+    va_end(ap);
+    return s ? client_send(i, s, n) : false;
+}
+
+static void room_presence(atom_t left, atom_t joined);
+
+/* close a connection and hand its slot and buffers back */
+static void disconnect_client(int i) {
+    client_t *c = &clients[i];
+    if (!conn_live[i]) return;
+    client_flush(i); /* best effort for a last "Goodbye" */
+    close(conn_in_fd[i]);
+    close(conn_out_fd[i]);
+    conn_live[i] = false;
+    room_presence(conn_room[i], ATOM_NONE);
+    presence_add(room_index(conn_room[i]), 0, 1);
+    metric_add(M_DISCONNECTS, 1);
+    flightrec_log(FR_DISCONNECT, i, NULL, 0, 0);
+    atom_unref(c->user);
+    atom_unref(conn_room[i]);
+    c->user = conn_room[i] = ATOM_NONE;
+    conn_ri[i] = -1;
+    if (c->in_buf) pool_put(c->in_buf, c->in_cap);
+    c->in_buf = NULL;
+    c->in_len = c->in_cap = 0;
+    while (c->out_head) {
+        outseg_t *next = c->out_head->next;
+        pool_put(c->out_head, OUTSEG_CAP);
+        c->out_head = next;
+    }
+    c->out_tail = NULL;
+    c->out_bytes = 0;
+    conn_queued[i] = false;
+    c->last_appeal[0] = '\0';
+    c->pm_waiting = 0;
+    twheel_cancel(&c->idle_timer);
+    twheel_cancel(&c->rate_timer);
+    c->hist_room = -1;
+    free_slots[free_top++] = i;
 }
 
 /* ------------ LOGGING ------------ */
-void append_room_log(const char *room, const char *msg) {
+/* line must already end in '\n' */
+void append_room_log(const char *room, const char *line, size_t len) {
     ensure_logdir();
     char path[256];
-    snprintf(path, sizeof(path), "%s/%s.log", LOGDIR, room);
+    snprintf(path, sizeof(path), "%s/%s.log", logdir, room);
 
     int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
     if (fd >= 0) {
-        write(fd, msg, strlen(msg));
-        write(fd, "\n", 1);
+        write(fd, line, len);
+        struct stat st;
+        bool full = fstat(fd, &st) == 0 && st.st_size >= HOT_LOG_MAX;
         close(fd);
+        /* age the hot window out into a compressed segment */
+        if (full) {
+            flightrec_log(FR_ROTATE, -1, room, 0, 0);
+            logstore_rotate(logdir, room);
+        }
     }
 }
 
-/* ------------ FILTER ------------ */
-char *run_filter_and_get_output(const char *input) {
-    int p2f[2], f2p[2];
-    if (pipe(p2f) < 0 || pipe(f2p) < 0)
-        return strdup(input);
+/* ------------ HISTORY ------------ */
+static int history_write_chunk(const char *data, size_t len, void *arg) {
+    int idx = *(int *)arg;
+    if (client_send(idx, data, len)) return 0;
+    client_printf(idx, "(history truncated)\n");
+    return 1;
+}
 
-    pid_t pid = fork();
-    if (pid < 0)
-        return strdup(input);
+typedef struct {
+    int idx;
+    const char *needle;
+    int hits;
+} search_ctx_t;
+
+static int search_chunk(const char *data, size_t len, void *arg) {
+    search_ctx_t *sc = arg;
+    const char *end = data + len;
+    while (data < end) {
+        const char *nl = memchr(data, '\n', end - data);
+        size_t ll = nl ? (size_t)(nl - data) : (size_t)(end - data);
+        if (memmem(data, ll, sc->needle, strlen(sc->needle))) {
+            client_printf(sc->idx, "%.*s\n", (int)ll, data);
+            if (++sc->hits >= SEARCH_MAX_RESULTS) return 1;
+        }
+        data += ll + 1;
+    }
+    return 0;
+}
 
-    if (pid == 0) {
-        dup2(p2f[0], STDIN_FILENO);
-        dup2(f2p[1], STDOUT_FILENO);
-        close(p2f[0]); close(p2f[1]); close(f2p[0]); close(f2p[1]);
-        execl("./filter", "./filter", NULL);
-        _exit(127);
+/* The last --history-cache logged lines of every room stay in memory,
+   filled from the tail of the hot log when the room appears and then
+   from every line logged (or, on other shards, forwarded) for it. A
+   /join pushes the newest --history-preload of them; /more pages
+   backwards, from the cache while it lasts and then from the log. Each
+   connection keeps its place as "lines back from the newest", adjusted
+   by how many lines have arrived since. */
+static void recent_push(int ri, const char *line, size_t len) {
+    if (ri < 0 || !history_cache) return;
+    recent_t *r = &room_recent[ri];
+    if (!r->slots && !(r->slots = calloc(history_cache, sizeof(*r->slots)))) return;
+    r->total++;
+    recent_slot_t *s = &r->slots[(r->head + r->count) % history_cache];
+    if (s->cap < len) { /* only a longer line than this slot has held */
+        pool_put(s->text, s->cap);
+        if (!(s->text = pool_get(len, &s->cap))) {
+            /* the cache must stay the newest lines without gaps: the
+               log serves them until it fills up again */
+            s->cap = 0;
+            r->head = r->count = 0;
+            return;
+        }
     }
+    memcpy(s->text, line, len); /* ends in '\n' */
+    s->len = len;
+    if (r->count == history_cache) r->head = (r->head + 1) % history_cache;
+    else r->count++;
+}
 
-    close(p2f[0]);
-    close(f2p[1]);
-    write(p2f[1], input, strlen(input));
-    write(p2f[1], "\n", 1);
-    close(p2f[1]);
+/* fill the cache of a new room from the end of its hot log */
+static void recent_warm(int ri) {
+    if (!history_cache) return;
+    char *path = arena_printf(NULL, "%s/%s.log", logdir, atom_str(rooms[ri]));
+    int fd = path ? open(path, O_RDONLY) : -1;
+    if (fd < 0) return;
+    off_t end = lseek(fd, 0, SEEK_END);
+    off_t from = end > HISTORY_WARM_BYTES ? end - HISTORY_WARM_BYTES : 0;
+    char *buf = end > 0 ? arena_alloc(end - from) : NULL;
+    ssize_t n = buf ? pread(fd, buf, end - from, from) : -1;
+    close(fd);
+    if (n <= 0) return;
+    char *p = buf, *stop = buf + n;
+    if (from > 0) { /* starts mid-line */
+        char *nl = memchr(p, '\n', stop - p);
+        p = nl ? nl + 1 : stop;
+    }
+    for (char *nl; p < stop && (nl = memchr(p, '\n', stop - p)); p = nl + 1)
+        recent_push(ri, p, nl + 1 - p);
+}
 
-    char buf[BUF];
-    ssize_t n = read(f2p[0], buf, sizeof(buf) - 1);
-    if (n <= 0) {
-        close(f2p[0]);
-        waitpid(pid, NULL, 0);
-        return strdup(input);
+/* line `back` counted from the newest (0), or NULL past the cache */
+static const recent_slot_t *recent_line(const recent_t *r, uint64_t back) {
+    if (back >= r->count) return NULL;
+    return &r->slots[(r->head + r->count - 1 - back) % history_cache];
+}
+
+static void report_history_stats(const char *room, const logstore_stats_t *st) {
+    if (st->blocks == 0) return;
+    printf("History %s: %zu blocks, %zu -> %zu bytes (%.2fx), decode %.1f MB/s, cache %zu/%zu hits\n",
+           room, st->blocks, st->comp_bytes, st->raw_bytes,
+           (double)st->raw_bytes / st->comp_bytes,
+           st->decode_sec > 0 ? st->decoded_bytes / st->decode_sec / 1e6 : 0.0,
+           st->cache_hits, st->cache_hits + st->cache_misses);
+}
+
+/* up to want lines of room ri older than the newest skip, oldest first;
+   returns how many were sent */
+static uint64_t history_page_send(int i, int ri, uint64_t skip, uint64_t want) {
+    const recent_t *r = &room_recent[ri];
+    uint64_t cached = skip < r->count ? r->count - skip : 0;
+    if (cached > want) cached = want;
+    uint64_t sent = 0;
+    if (cached < want) {
+        /* past the cache: read the log backwards from where it ends */
+        logstore_stats_t st;
+        long n = logstore_tail(logdir, atom_str(rooms[ri]), skip + cached, want - cached,
+                               history_write_chunk, &i, &st);
+        if (n > 0) sent = n;
+        metric_add(M_HISTORY_READS, 1);
+        report_history_stats(atom_str(rooms[ri]), &st);
+    }
+    for (uint64_t k = cached; k-- > 0;) {
+        const recent_slot_t *line = recent_line(r, skip + k);
+        client_send(i, line->text, line->len);
     }
-    buf[n] = '\0';
-    trim_newline(buf);
-    close(f2p[0]);
-    waitpid(pid, NULL, 0);
+    return sent + cached;
+}
 
-    return strdup(buf);
+/* /join: the newest lines, and the /more cursor starts above them */
+static void history_preload_send(int i, int ri) {
+    client_t *c = &clients[i];
+    c->hist_room = ri;
+    c->hist_skip = 0;
+    if (ri < 0) return;
+    c->hist_mark = room_recent[ri].total;
+    uint64_t n = room_recent[ri].count < history_preload ? room_recent[ri].count : history_preload;
+    if (n == 0) return;
+    client_printf(i, "--- last %llu messages in %s (/more for older) ---\n",
+                  (unsigned long long)n, atom_str(rooms[ri]));
+    c->hist_skip = history_page_send(i, ri, 0, n);
 }
 
-/* ------------ BROADCAST ------------ */
+/* /more: the next page back from where this connection got to */
+static void history_more(int i, int ri) {
+    client_t *c = &clients[i];
+    if (ri < 0) return;
+    if (c->hist_room != ri) { /* not preloaded here: start from the newest */
+        c->hist_room = ri;
+        c->hist_skip = 0;
+        c->hist_mark = room_recent[ri].total;
+    }
+    c->hist_skip += room_recent[ri].total - c->hist_mark;
+    c->hist_mark = room_recent[ri].total;
+    client_printf(i, "--- older messages in %s ---\n", atom_str(rooms[ri]));
+    uint64_t n = history_page_send(i, ri, c->hist_skip, history_page);
+    c->hist_skip += n;
+    if (n == 0) client_printf(i, "No older history\n");
+}
 
+/* ------------ FILTER ------------ */
+/* The word list is compiled into an in-process matcher (wordfilter.c);
+   SIGHUP or ADMIN RELOADFILTER rebuild it from the same file and swap it
+   in without stopping the loop. */
+static const char *words_path = "filter.words";
+
+/* reload and report to stdout and, if i >= 0, to that client */
+static void reload_filter(int i) {
+    int n = wordfilter_load(words_path);
+    if (n < 0) {
+        printf("Filter reload from %s failed, keeping %u words\n", words_path, wordfilter_words());
+        if (i >= 0) client_printf(i, "Filter reload failed, keeping %u words\n", wordfilter_words());
+    } else {
+        printf("Filter reloaded: %d words from %s (generation %u)\n", n, words_path,
+               wordfilter_generation());
+        if (i >= 0) client_printf(i, "Filter reloaded: %d words\n", n);
+    }
+    fflush(stdout);
+}
 
+/* mask text in place; short repeated lines are served from filtercache
+   without running the matcher. Runs on the loop or a filter worker. */
+static void filter_in_place(char *text, size_t len) {
+    uint64_t t0 = metrics_now_ns();
+    unsigned gen = wordfilter_generation();
+    uint64_t h;
+    char orig[FC_MAX_LEN];
+    if (filtercache_get(text, len, gen, text, &h)) {
+        metric_add(M_FILTER_CACHE_HITS, 1);
+    } else if (len && len <= FC_MAX_LEN) {
+        memcpy(orig, text, len);
+        wordfilter_apply(text, len);
+        metric_add(M_FILTER_CACHE_MISSES, 1);
+        filtercache_put(h, orig, text, len, gen);
+    } else {
+        wordfilter_apply(text, len);
+    }
+    metric_record(H_FILTER_NS, metrics_now_ns() - t0);
+}
 
+/* returned string lives in the loop arena (or is input itself) */
+const char *run_filter_and_get_output(const char *input) {
+    char *out = arena_strdup(input);
+    if (!out) return input;
+    filter_in_place(out, strlen(out));
+    return out;
+}
+
+/* ------------ FILTER POOL ------------ */
+/* Long messages are filtered on worker threads (filterpool.c) so one big
+   paste does not stall every room behind it. Ordering keys are room
+   indices, then max_rooms + recipient slot for PMs; once a key has a job
+   in flight, everything for it goes through the pool until it drains. */
+static unsigned filter_threads = 0;
+
+typedef struct {
+    fp_job_t job;      /* first: the pool hands this back */
+    size_t cap;        /* pool buffer size */
+    int ri;            /* room index, or -1 for a PM */
+    int to;            /* PM recipient slot */
+    atom_t to_user;    /* ...and who was in it, referenced */
+    uint64_t t_start;
+    bool traced;
+    trace_rec_t trace;
+    char *sender;      /* points into data */
+    char data[];       /* sender\0text\0 */
+} route_job_t;
+
+static bool offload_wanted(unsigned key, size_t len) {
+    return filterpool_threads() > 0 && (len >= FILTER_OFFLOAD_MIN || filterpool_pending(key));
+}
+
+/* hand msg to the pool; false if no buffer (the caller filters inline) */
+static bool offload(unsigned key, int ri, int to, const char *sender, const char *msg,
+                    size_t len, uint64_t t_start) {
+    size_t slen = strlen(sender), cap;
+    route_job_t *rj = pool_get(sizeof(*rj) + slen + len + 2, &cap);
+    if (!rj) return false;
+    rj->cap = cap;
+    rj->ri = ri;
+    rj->to = to;
+    rj->to_user = ATOM_NONE;
+    if (to >= 0) {
+        rj->to_user = clients[to].user;
+        atom_ref(rj->to_user);
+    }
+    rj->t_start = t_start;
+    rj->traced = tracing;
+    if (tracing) rj->trace = cur_trace;
+    tracing = false; /* the record travels with the job */
+    rj->sender = rj->data;
+    memcpy(rj->sender, sender, slen + 1);
+    rj->job.key = key;
+    rj->job.text = rj->data + slen + 1;
+    rj->job.len = len;
+    memcpy(rj->job.text, msg, len + 1);
+    filterpool_submit(&rj->job);
+    return true;
+}
+
+static void deliver_to_room(const char *room, int ri, const char *sender, const char *filtered,
+                            uint64_t t_start);
+static bool forward_to_owner(int ri, const char *sender, const char *msg);
+static void forward_line(int ri, atom_t rid, const char *room, const char *line, size_t len);
+static void federate_line(atom_t rid, const char *room, const char *line, size_t len);
+
+static void deliver_filtered(fp_job_t *j) {
+    route_job_t *rj = (route_job_t *)j;
+    if (rj->ri >= 0) {
+        tracing = rj->traced;
+        if (tracing) cur_trace = rj->trace;
+        deliver_to_room(atom_str(rooms[rj->ri]), rj->ri, rj->sender, j->text, rj->t_start);
+        if (tracing) trace_submit(&cur_trace);
+        tracing = false;
+    } else if (conn_live[rj->to] && clients[rj->to].user == rj->to_user) {
+        client_printf(rj->to, "[PM] %s -> you: %s\n", rj->sender, j->text);
+        metric_add(M_PMS_ROUTED, 1);
+    }
+    atom_unref(rj->to_user);
+    pool_put(rj, rj->cap);
+}
 
+/* ------------ BROADCAST ------------ */
 void broadcast_to_room(const char *room, const char *from, const char *msg) {
     if (!room) return;
-    add_room_if_missing(room);
-    char *filtered = run_filter_and_get_output(msg ? msg : "");
-    char line[BUF];
+    uint64_t t_start = metrics_now_ns();
+    int ri = add_room_if_missing(room);
     const char *sender = from ? from : "server";
-    snprintf(line, sizeof(line), "[%s] %s: %s", room, sender, filtered);
-    append_room_log(room, line);
+    if (!msg) msg = "";
+    if (ri >= 0 && forward_to_owner(ri, sender, msg)) return;
+    size_t mlen = strlen(msg);
+    if (ri >= 0 && offload_wanted(ri, mlen) && offload(ri, ri, -1, sender, msg, mlen, t_start))
+        return;
+    deliver_to_room(room, ri, sender, run_filter_and_get_output(msg), t_start);
+}
 
+/* send line to our connections in room rid; returns the recipients */
+static int fan_out(atom_t rid, const char *line, size_t len) {
     /* If room == "global" send to all connected clients (broadcast) */
-    if (strcmp(room, "global") == 0) {
-        for (int i = 0; i < MAX_CLIENTS; ++i) {
-            if (clients[i].connected) {
-                writef(clients[i].to_child_fd, "%s\n", line);
+    int sent = 0;
+    if (rid == global_room) {
+        for (int i = 0; i < max_clients; ++i) {
+            if (conn_live[i]) {
+                client_send(i, line, len);
+                sent++;
             }
         }
     } else {
         /* send only to clients in that room (no monitor copies to admins) */
-        for (int i = 0; i < MAX_CLIENTS; ++i) {
-            if (clients[i].connected && strcmp(clients[i].room, room) == 0) {
-                writef(clients[i].to_child_fd, "%s\n", line);
+        for (int i = 0; i < max_clients; ++i) {
+            if (conn_live[i] && conn_room[i] == rid) { /* hot arrays only */
+                client_send(i, line, len);
+                sent++;
             }
         }
     }
-
-    free(filtered);
+    return sent;
 }
 
+/* log and fan out a line that has been through the filter */
+static void deliver_to_room(const char *room, int ri, const char *sender, const char *filtered,
+                            uint64_t t_start) {
+    /* format once; every recipient gets the same bytes */
+    size_t len;
+    char *line = arena_printf(&len, "[%s] %s: %s\n", room, sender, filtered);
+    if (!line) return;
+    uint64_t t0 = metrics_now_ns();
+    append_room_log(room, line, len);
+    uint64_t t1 = metrics_now_ns();
+    metric_record(H_LOG_WRITE_NS, t1 - t0);
+    if (tracing) {
+        cur_trace.ts[TS_FILTER] = t0;
+        cur_trace.ts[TS_LOG] = t1;
+    }
 
-
-
+    recent_push(ri, line, len);
+
+    atom_t rid = intern_lookup(room);
+    int sent = fan_out(rid, line, len);
+    if (bus_shards() > 1) forward_line(ri, rid, room, line, len);
+    federate_line(rid, room, line, len);
+    metric_record(H_FANOUT, sent);
+    metric_add(M_MSGS_ROUTED, 1);
+    if (ri >= 0) room_msgs[ri]++;
+    flightrec_log(FR_BROADCAST, -1, room, sent, metrics_now_ns() - t_start);
+    if (tracing) {
+        cur_trace.ts[TS_FANOUT] = metrics_now_ns();
+        cur_trace.room = rid;
+        cur_trace.fanout = sent;
+    }
+}
 
 /* ------------ PM ------------ */
+int find_client_by_name(const char *name) {
+    atom_t a = intern_lookup(name);
+    if (a == ATOM_NONE) return -1;
+    for (int i = 0; i < max_clients; ++i)
+        if (conn_live[i] && clients[i].user == a)
+            return i;
+    return -1;
+}
+
 bool send_private(const char *from, const char *to, const char *msg) {
     if (!from || !to || !msg) return false;
-    for (int i = 0; i < MAX_CLIENTS; ++i) {
-        if (clients[i].connected && strcmp(clients[i].username, to) == 0) {
-            char *filtered = run_filter_and_get_output(msg);
-            writef(clients[i].to_child_fd, "[PM] %s -> you: %s\n", from, filtered);
-            free(filtered);
-            return true;
+    int i = find_client_by_name(to);
+    if (i < 0) return false;
+    size_t mlen = strlen(msg);
+    unsigned key = max_rooms + i;
+    if (offload_wanted(key, mlen) && offload(key, -1, i, from, msg, mlen, metrics_now_ns()))
+        return true;
+    const char *filtered = run_filter_and_get_output(msg);
+    client_printf(i, "[PM] %s -> you: %s\n", from, filtered);
+    metric_add(M_PMS_ROUTED, 1);
+    return true;
+}
+
+/* ------------ FEDERATION ------------ */
+/* Servers started with --peer / --peer-listen link up over TCP (peer.c).
+   Each tells its peers which rooms it has members in (ROOMS, resent
+   whenever that set changes), and a routed line goes only to the peers
+   that listed its room, or to all of them for "global". A forwarded line
+   is delivered to local members but not logged or passed on, so every
+   server in a federation peers with every other. Frames queued for a
+   link during one loop pass leave in a single write. */
+static bool federated = false;
+static bool summary_dirty = false; /* our set of occupied rooms changed */
+static atom_t *peer_rooms[PEER_MAX]; /* max_rooms each */
+static int peer_room_count[PEER_MAX];
+
+static int local_members(atom_t room) {
+    int n = 0;
+    for (int i = 0; i < max_clients; ++i) n += conn_live[i] && conn_room[i] == room;
+    return n;
+}
+
+static void peer_forget_rooms(int link) {
+    for (int r = 0; r < peer_room_count[link]; ++r) atom_unref(peer_rooms[link][r]);
+    peer_room_count[link] = 0;
+}
+
+static bool peer_wants(int link, atom_t rid) {
+    if (rid == global_room) return true;
+    for (int r = 0; r < peer_room_count[link]; ++r)
+        if (peer_rooms[link][r] == rid) return true;
+    return false;
+}
+
+static void peer_put(int link, const char *frame, size_t len) {
+    if (peer_send(link, frame, len)) metric_add(M_PEER_OUT, 1);
+    else metric_add(M_PEER_DROPS, 1);
+}
+
+static void federate_line(atom_t rid, const char *room, const char *line, size_t len) {
+    if (!federated || rid == ATOM_NONE) return;
+    char *frame = NULL;
+    size_t n = 0;
+    for (int k = 0; k < PEER_MAX; ++k) {
+        if (!peer_up(k) || !peer_wants(k, rid)) continue;
+        /* the line's newline is the frame's */
+        if (!frame && !(frame = arena_printf(&n, "MSG|%s|%.*s", room, (int)len - 1, line))) return;
+        peer_put(k, frame, n);
+    }
+}
+
+/* ROOMS|a|b|...: every room we have members in; link -1 for all peers */
+static void send_summary(int link) {
+    size_t cap = 8 + (size_t)room_count * (ATOM_MAX_LEN + 1), n = 5;
+    char *frame = arena_alloc(cap);
+    if (!frame) return;
+    memcpy(frame, "ROOMS", n);
+    for (int r = 0; r < room_count; ++r)
+        if (rooms[r] != global_room && local_members(rooms[r]) > 0)
+            n += snprintf(frame + n, cap - n, "|%s", atom_str(rooms[r]));
+    for (int k = 0; k < PEER_MAX; ++k)
+        if ((link < 0 || link == k) && peer_up(k)) peer_put(k, frame, n);
+}
+
+static void handle_peer_frame(int link, char *buf, size_t len) {
+    (void)len;
+    metric_add(M_PEER_IN, 1);
+    char *save = NULL;
+    char *cmd = strtok_r(buf, "|", &save);
+    if (!cmd) return;
+
+    switch (cmd_lookup(CMD_LAYER_PEER, cmd, strlen(cmd))) {
+    case PEER_MSG: {
+        /* MSG|room|formatted line without its newline */
+        char *room = strtok_r(NULL, "|", &save);
+        char *line = strtok_r(NULL, "", &save);
+        atom_t rid = room ? intern_lookup(room) : ATOM_NONE;
+        if (rid == ATOM_NONE || !line) return;
+        size_t n;
+        char *out = arena_printf(&n, "%s\n", line);
+        if (out) fan_out(rid, out, n);
+        break;
+    }
+
+    case PEER_ROOMS: {
+        peer_forget_rooms(link);
+        char *room;
+        while ((room = strtok_r(NULL, "|", &save)) && peer_room_count[link] < max_rooms) {
+            atom_t a = intern(room);
+            if (a != ATOM_NONE) peer_rooms[link][peer_room_count[link]++] = a;
         }
+        break;
     }
+
+    default:
+        break;
+    }
+}
+
+static void handle_peer_state(int link, bool up) {
+    peer_forget_rooms(link);
+    if (up) send_summary(link);
+}
+
+/* ------------ SHARDS ------------ */
+/* With --shards N the server runs as N processes sharing the port
+   (SO_REUSEPORT spreads the connections). Each room belongs to the shard
+   whose range its name hashes into; that shard alone filters, logs and
+   counts the room's messages. Other shards forward their MSGs to it over
+   the bus (bus.c), tell it when they gain or lose their last member of a
+   room (SUB/UNSUB), and get the formatted line back (LINE) to fan out to
+   their own connections. Frames between two shards stay in order, so a
+   member's SUB always lands before its first MSG. A PM for someone not
+   connected here is offered to every other shard, and the sender hears
+   back once one delivers it or all have said no (PMR). */
+static pid_t shard_pids[BUS_MAX_SHARDS];
+static uint32_t pm_seq_next = 0;
+
+static bool bus_printf(unsigned to, const char *fmt, ...) {
+    size_t n;
+    va_list ap;
+    va_start(ap, fmt);
+    char *s = arena_vprintf(&n, fmt, ap);
+    va_end(ap);
+    if (s && bus_send(to, s, n)) {
+        metric_add(M_BUS_OUT, 1);
+        return true;
+    }
+    metric_add(M_BUS_DROPS, 1);
     return false;
 }
 
+static unsigned atom_owner(atom_t a) {
+    return bus_owner(atom_hash(a));
+}
+
+/* a message for a room another shard owns goes there to be routed */
+static bool forward_to_owner(int ri, const char *sender, const char *msg) {
+    if (bus_shards() == 1) return false;
+    unsigned owner = atom_owner(rooms[ri]);
+    if (owner == bus_self()) return false;
+    bus_printf(owner, "MSG|%s|%s|%s", sender, atom_str(rooms[ri]), msg);
+    tracing = false; /* stages after this one happen in another process */
+    return true;
+}
+
+/* hand a routed line to every shard with members in the room */
+static void forward_line(int ri, atom_t rid, const char *room, const char *line, size_t len) {
+    uint32_t subs = rid == global_room ? ~0u : ri >= 0 ? room_shards[ri] : 0;
+    if (!subs) return;
+    size_t n;
+    char *frame = arena_printf(&n, "LINE|%s|%.*s", room, (int)len, line);
+    if (!frame) return;
+    for (unsigned k = 0; k < bus_shards(); ++k) {
+        if (k == bus_self() || !(subs >> k & 1)) continue;
+        if (bus_send(k, frame, n)) metric_add(M_BUS_OUT, 1);
+        else metric_add(M_BUS_DROPS, 1);
+    }
+}
+
+/* a connection moved from room left to room joined (either may be
+   ATOM_NONE); keep the owners' member maps current */
+static void room_presence(atom_t left, atom_t joined) {
+    if (left == joined) return;
+    bool emptied = left != ATOM_NONE && left != global_room && local_members(left) == 0;
+    bool first = joined != ATOM_NONE && joined != global_room && local_members(joined) == 1;
+    if (emptied || first) summary_dirty = true;
+    if (bus_shards() == 1) return;
+    if (emptied && atom_owner(left) != bus_self())
+        bus_printf(atom_owner(left), "UNSUB|%s", atom_str(left));
+    if (first && atom_owner(joined) != bus_self())
+        bus_printf(atom_owner(joined), "SUB|%s", atom_str(joined));
+}
+
+/* let every shard list a room that was just created here */
+static void announce_room(const char *room) {
+    for (unsigned k = 0; k < bus_shards(); ++k)
+        if (k != bus_self()) bus_printf(k, "ROOM|%s", room);
+}
+
+static void pm_remote(int i, const char *from, const char *to, const char *msg) {
+    client_t *c = &clients[i];
+    c->pm_seq = ++pm_seq_next;
+    c->pm_waiting = 0;
+    for (unsigned k = 0; k < bus_shards(); ++k)
+        if (k != bus_self() && bus_printf(k, "PM|%d|%u|%s|%s|%s", i, c->pm_seq, from, to, msg))
+            c->pm_waiting++;
+    if (c->pm_waiting == 0) client_printf(i, "User %s not found\n", to);
+}
+
+/* one frame from shard `from` */
+static void handle_bus_frame(unsigned from, char *buf, size_t len) {
+    (void)len;
+    metric_add(M_BUS_IN, 1);
+    char *save = NULL;
+    char *cmd = strtok_r(buf, "|", &save);
+    if (!cmd) return;
+
+    switch (cmd_lookup(CMD_LAYER_BUS, cmd, strlen(cmd))) {
+    case BUS_MSG: {
+        /* MSG|user|room|message: we own the room */
+        char *username = strtok_r(NULL, "|", &save);
+        char *room = strtok_r(NULL, "|", &save);
+        char *message = strtok_r(NULL, "", &save);
+        if (!username || !room) return;
+        uint64_t t0 = metrics_now_ns();
+        broadcast_to_room(room, username, message ? message : "");
+        metric_record(H_ROUTE_NS, metrics_now_ns() - t0);
+        break;
+    }
+
+    case BUS_LINE: {
+        /* LINE|room|formatted line: the owner routed it, deliver here */
+        char *room = strtok_r(NULL, "|", &save);
+        char *line = strtok_r(NULL, "", &save);
+        if (!room || !line) return;
+        atom_t rid = intern_lookup(room);
+        if (rid == ATOM_NONE) return;
+        size_t n = strlen(line);
+        recent_push(room_index(rid), line, n); /* the owner has logged it */
+        fan_out(rid, line, n);
+        break;
+    }
+
+    case BUS_SUB:
+    case BUS_UNSUB: {
+        char *room = strtok_r(NULL, "|", &save);
+        int ri = room ? add_room_if_missing(room) : -1;
+        if (ri < 0) return;
+        if (cmd[0] == 'S') room_shards[ri] |= 1u << from;
+        else room_shards[ri] &= ~(1u << from);
+        break;
+    }
+
+    case BUS_ROOM: {
+        char *room = strtok_r(NULL, "|", &save);
+        if (room) add_room_if_missing(room);
+        break;
+    }
+
+    case BUS_PRES: {
+        /* PRES|room|joined|left: presence on another shard, we own the room */
+        char *room = strtok_r(NULL, "|", &save);
+        char *joined = strtok_r(NULL, "|", &save);
+        char *left = strtok_r(NULL, "|", &save);
+        if (!room || !joined || !left) return;
+        presence_add(add_room_if_missing(room), strtoul(joined, NULL, 10), strtoul(left, NULL, 10));
+        break;
+    }
+
+    case BUS_PM: {
+        /* PM|slot|seq|from|to|message: answer whether we delivered it */
+        char *slot = strtok_r(NULL, "|", &save);
+        char *seq = strtok_r(NULL, "|", &save);
+        char *pm_from = strtok_r(NULL, "|", &save);
+        char *to = strtok_r(NULL, "|", &save);
+        char *message = strtok_r(NULL, "", &save);
+        if (!slot || !seq || !pm_from || !to) return;
+        bool found = send_private(pm_from, to, message ? message : "");
+        bus_printf(from, "PMR|%s|%s|%d|%s", slot, seq, found, to);
+        break;
+    }
+
+    case BUS_PMR: {
+        /* PMR|slot|seq|found|to */
+        char *slot = strtok_r(NULL, "|", &save);
+        char *seq = strtok_r(NULL, "|", &save);
+        char *found = strtok_r(NULL, "|", &save);
+        char *to = strtok_r(NULL, "|", &save);
+        if (!slot || !seq || !found || !to) return;
+        int i = atoi(slot);
+        if (i < 0 || i >= max_clients || !conn_live[i]) return;
+        client_t *c = &clients[i];
+        if (c->pm_waiting == 0 || c->pm_seq != strtoul(seq, NULL, 10)) return;
+        if (atoi(found)) {
+            client_printf(i, "PM sent to %s\n", to);
+            c->pm_waiting = 0;
+        } else if (--c->pm_waiting == 0) {
+            client_printf(i, "User %s not found\n", to);
+        }
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+/* ------------ PRESENCE ------------ */
+/* Joins and leaves are announced by the server without the filter or
+   the room log. In a room with fewer than --presence-batch local members
+   each one goes out at once; in a bigger room the first starts a
+   --presence-window batch and the rest are counted into it, so a storm
+   of N joins costs one line per window instead of N fan-outs. With
+   shards, the room's owner collects the counts from every shard. */
+static void presence_announce(int ri) {
+    presence_t *p = &room_presence_batch[ri];
+    const char *what;
+    if (p->joined == 1 && !p->left) what = "a new user has joined";
+    else if (!p->joined && p->left == 1) what = "a user has left";
+    else if (!p->left) what = arena_printf(NULL, "%u users joined", p->joined);
+    else if (!p->joined) what = arena_printf(NULL, "%u users left", p->left);
+    else what = arena_printf(NULL, "%u joined, %u left", p->joined, p->left);
+    p->joined = p->left = 0;
+    if (!what) return;
+
+    atom_t rid = rooms[ri];
+    const char *room = atom_str(rid);
+    size_t len;
+    char *line = arena_printf(&len, "[%s] server: %s\n", room, what);
+    if (!line) return;
+    int sent = fan_out(rid, line, len);
+    if (bus_shards() > 1) forward_line(ri, rid, room, line, len);
+    federate_line(rid, room, line, len);
+    metric_record(H_FANOUT, sent);
+    metric_add(M_PRESENCE_LINES, 1);
+}
+
+static void presence_fire(twheel_timer_t *t) {
+    presence_announce((int)(intptr_t)t->arg);
+}
+
+static void presence_add(int ri, unsigned joined, unsigned left) {
+    if (ri < 0 || (!joined && !left)) return;
+    atom_t rid = rooms[ri];
+    if (bus_shards() > 1 && atom_owner(rid) != bus_self()) {
+        bus_printf(atom_owner(rid), "PRES|%s|%u|%u", atom_str(rid), joined, left);
+        return;
+    }
+    presence_t *p = &room_presence_batch[ri];
+    p->joined += joined;
+    p->left += left;
+    metric_add(M_PRESENCE_EVENTS, joined + left);
+    if (twheel_armed(&p->timer)) return; /* goes out with the batch */
+    if ((unsigned)local_members(rid) < presence_batch) presence_announce(ri);
+    else twheel_arm(&p->timer, presence_window);
+}
+
+/* ------------ STATS ------------ */
+/* gauges read from live state plus the aggregated metrics registry;
+   the text lives in the loop arena */
+static char *format_stats(size_t *len) {
+    int active = 0, queued = 0;
+    size_t queued_bytes = 0, max_queue = 0;
+    for (int i = 0; i < max_clients; ++i) {
+        if (!conn_live[i]) continue;
+        active++;
+        if (!conn_queued[i]) continue;
+        queued++;
+        queued_bytes += clients[i].out_bytes;
+        if (clients[i].out_bytes > max_queue) max_queue = clients[i].out_bytes;
+    }
+
+    metrics_snapshot_t snap;
+    metrics_collect(&snap);
+    uint64_t fc_lookups = snap.counters[M_FILTER_CACHE_HITS] + snap.counters[M_FILTER_CACHE_MISSES];
+    size_t cap = 8192;
+    char *buf = arena_alloc(cap);
+    if (!buf) return NULL;
+    int n = snprintf(buf, cap,
+                     "shard              %u/%u\n"
+                     "clients            %d\n"
+                     "rooms              %d\n"
+                     "atoms              %u\n"
+                     "queued_clients     %d\n"
+                     "queued_bytes       %zu\n"
+                     "max_queue_bytes    %zu\n"
+                     "arena_bytes        %zu\n"
+                     "arena_heap_allocs  %lu\n"
+                     "pool_slabs         %lu\n"
+                     "timers             %zu\n"
+                     "filter_cache_hit   %.1f%%\n",
+                     bus_self(), bus_shards(), active, room_count, atom_count(), queued, queued_bytes, max_queue,
+                     arena.cap, arena.heap_allocs, pool_slabs, twheel_count(),
+                     fc_lookups ? 100.0 * snap.counters[M_FILTER_CACHE_HITS] / fc_lookups : 0.0);
+    if (n < 0 || (size_t)n >= cap) n = 0;
+    *len = n + metrics_format(&snap, buf + n, cap - n);
+    return buf;
+}
+
+/* ------------ METRICS ENDPOINT ------------ */
+/* Prometheus text for the optional --metrics listener. Rendered straight
+   from the hot arrays and the registry on each scrape; nothing is kept
+   up to date in between. */
+static size_t prom_label(char *dst, size_t cap, const char *s) {
+    size_t o = 0;
+    for (; *s && o + 2 < cap; ++s) {
+        if (*s == '"' || *s == '\\') dst[o++] = '\\';
+        else if (*s == '\n') { dst[o++] = '\\'; dst[o++] = 'n'; continue; }
+        dst[o++] = *s;
+    }
+    dst[o] = '\0';
+    return o;
+}
+
+static size_t render_metrics(const char *path, char *buf, size_t cap) {
+    if (strcmp(path, "/metrics") != 0 && strcmp(path, "/") != 0) return (size_t)-1;
+
+    int active = 0;
+    size_t queued_bytes = 0;
+    int *members = arena_alloc(max_rooms * sizeof(*members));
+    if (!members) return 0;
+    memset(members, 0, max_rooms * sizeof(*members));
+    for (int i = 0; i < max_clients; ++i) {
+        if (!conn_live[i]) continue;
+        active++;
+        queued_bytes += clients[i].out_bytes;
+        if (conn_ri[i] >= 0) members[conn_ri[i]]++;
+    }
+
+    metrics_snapshot_t snap;
+    metrics_collect(&snap);
+    size_t off = metrics_format_prometheus(&snap, "chat", buf, cap);
+#define OUT(...) do { \
+        int n_ = snprintf(buf + off, off < cap ? cap - off : 0, __VA_ARGS__); \
+        if (n_ > 0) off += (size_t)n_; \
+    } while (0)
+    OUT("# TYPE chat_clients gauge\nchat_clients %d\n", active);
+    OUT("# TYPE chat_rooms gauge\nchat_rooms %d\n", room_count);
+    OUT("# TYPE chat_atoms gauge\nchat_atoms %u\n", atom_count());
+    OUT("# TYPE chat_queued_bytes gauge\nchat_queued_bytes %zu\n", queued_bytes);
+    OUT("# TYPE chat_pool_slabs gauge\nchat_pool_slabs %lu\n", pool_slabs);
+    OUT("# TYPE chat_room_members gauge\n");
+    for (int r = 0; r < room_count; ++r) {
+        char name[2 * ATOM_MAX_LEN + 1];
+        prom_label(name, sizeof(name), atom_str(rooms[r]));
+        OUT("chat_room_members{room=\"%s\"} %d\n", name, members[r]);
+    }
+    OUT("# TYPE chat_room_messages_total counter\n");
+    for (int r = 0; r < room_count; ++r) {
+        char name[2 * ATOM_MAX_LEN + 1];
+        prom_label(name, sizeof(name), atom_str(rooms[r]));
+        OUT("chat_room_messages_total{room=\"%s\"} %llu\n", name,
+            (unsigned long long)room_msgs[r]);
+    }
+#undef OUT
+    return off; /* cap or more: httpd grows the buffer and asks again */
+}
+
 /* ------------ SIGNAL HANDLERS ------------ */
 void sigint_handler(int s) { (void)s; shutdown_requested = 1; }
-void sigusr1_handler(int s) {
-    int active = 0;
-    for (int i = 0; i < MAX_CLIENTS; ++i)
-        if (clients[i].connected) active++;
-    printf("Stats: %d clients, %d rooms\n", active, room_count);
+
+/* SIGUSR1 (stats dump) and SIGHUP (filter reload) arrive through a
+   signalfd, so they are handled in the main loop rather than in signal
+   context */
+static int signal_fd = -1;
+
+static void handle_signalfd(void) {
+    struct signalfd_siginfo si;
+    while (read(signal_fd, &si, sizeof(si)) == sizeof(si)) {
+        if (si.ssi_signo == SIGHUP) { reload_filter(-1); continue; }
+        if (si.ssi_signo != SIGUSR1) continue;
+        size_t len;
+        char *text = format_stats(&len);
+        if (!text) continue;
+        printf("Stats:\n%.*s", (int)len, text);
+        fflush(stdout);
+    }
 }
 
 /* ------------ CLEANUP ------------ */
 void cleanup_and_exit() {
-    for (int i = 0; i < MAX_CLIENTS; ++i)
-        if (clients[i].connected)
-            writef(clients[i].to_child_fd, "/server_shutdown\n");
+    for (int i = 0; i < max_clients; ++i)
+        if (conn_live[i]) {
+            client_printf(i, "/server_shutdown\n");
+            client_flush(i);
+        }
 
+    filterpool_stop();
+    for (unsigned k = 1; k < bus_shards(); ++k)
+        if (shard_pids[k] > 0) kill(shard_pids[k], SIGINT);
     while (wait(NULL) > 0) {}
     if (listen_fd != -1) close(listen_fd);
+    if (handoff_fd != -1) {
+        close(handoff_fd);
+        unlink(handoff_path);
+    }
     exit(0);
 }
 
+/* ------------ HOT RESTART ------------ */
+/* A new server started with the same -U path connects to the running one
+   and takes over without dropping anybody: the listening socket and each
+   connection's pipes travel over SCM_RIGHTS (handoff.c), along with the
+   room list and per-connection state down to half-read frames and queued
+   output. Connection children are not touched, so they keep running the
+   old binary and the frame protocol must stay compatible across an
+   upgrade. Traces, metrics and the flight recorder start afresh. */
+#define HO_VERSION 1
+#define HO_TIMEOUT_SEC 5
+
+enum { HO_HELLO = 1, HO_LISTEN, HO_ROOM, HO_CLIENT, HO_END, HO_ACK };
+
+static void handoff_timeouts(int sock) {
+    struct timeval tv = {HO_TIMEOUT_SEC, 0};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static void close_fds(const int *fds, int nfds) {
+    for (int k = 0; k < nfds; ++k) close(fds[k]);
+}
+
+/* old side: everything after HELLO, up to END */
+static int handoff_send_state(int sock) {
+    ho_buf_t b = {0};
+    ho_put_u64(&b, HO_VERSION);
+    int rc = b.bad ? -1 : handoff_send(sock, HO_LISTEN, b.buf, b.len, &listen_fd, 1);
+    for (int r = 0; rc == 0 && r < room_count; ++r) {
+        b.len = 0;
+        ho_put_str(&b, atom_str(rooms[r]));
+        ho_put_u64(&b, room_msgs[r]);
+        rc = b.bad ? -1 : handoff_send(sock, HO_ROOM, b.buf, b.len, NULL, 0);
+    }
+    for (int i = 0; rc == 0 && i < max_clients; ++i) {
+        if (!conn_live[i]) continue;
+        client_t *c = &clients[i];
+        b.len = 0;
+        ho_put_u64(&b, i);
+        ho_put_u64(&b, c->pid);
+        ho_put_str(&b, atom_str(c->user));
+        ho_put_str(&b, atom_str(conn_room[i]));
+        ho_put_u64(&b, c->muted);
+        ho_put_u64(&b, c->is_admin);
+        ho_put_str(&b, c->last_appeal);
+        ho_put_bytes(&b, c->in_buf, c->in_len);
+        uint64_t nseg = 0;
+        for (outseg_t *s = c->out_head; s; s = s->next) nseg++;
+        ho_put_u64(&b, nseg);
+        for (outseg_t *s = c->out_head; s; s = s->next) ho_put_bytes(&b, s->data + s->off, s->len);
+        int fds[2] = {conn_in_fd[i], conn_out_fd[i]};
+        rc = b.bad ? -1 : handoff_send(sock, HO_CLIENT, b.buf, b.len, fds, 2);
+    }
+    ho_free(&b);
+    return rc == 0 ? handoff_send(sock, HO_END, NULL, 0, NULL, 0) : -1;
+}
+
+/* a new server connected: hand everything over and exit once it has
+   acknowledged; on any failure keep serving as if nothing happened */
+static void handoff_serve(void) {
+    int sock = accept4(handoff_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (sock < 0) return;
+    handoff_timeouts(sock);
+
+    uint32_t type;
+    void *data;
+    size_t len;
+    int fds[HO_MAX_FDS], nfds;
+    if (handoff_recv(sock, &type, &data, &len, fds, &nfds) < 0) {
+        close(sock);
+        return;
+    }
+    close_fds(fds, nfds);
+    ho_buf_t b = {.buf = data, .len = len};
+    uint64_t version = ho_get_u64(&b);
+    ho_free(&b);
+    if (type != HO_HELLO || version != HO_VERSION) {
+        fprintf(stderr, "handoff: incompatible peer, staying up\n");
+        close(sock);
+        return;
+    }
+
+    /* nothing may be left in flight: filter jobs refer to our memory */
+    filterpool_drain(deliver_filtered);
+    for (int i = 0; i < max_clients; ++i)
+        if (conn_live[i]) client_flush(i);
+    httpd_close(); /* frees the metrics and peer addresses for the new server */
+    peer_close();
+
+    bool acked = false;
+    if (handoff_send_state(sock) == 0 && handoff_recv(sock, &type, &data, &len, fds, &nfds) == 0) {
+        close_fds(fds, nfds);
+        free(data);
+        acked = type == HO_ACK;
+    }
+    close(sock);
+    if (acked) {
+        /* the sockets live on in the new server; keep handoff_path, it is
+           the new server's now */
+        printf("Handed over to the new server, exiting\n");
+        fflush(stdout);
+        filterpool_stop();
+        exit(0);
+    }
+    fprintf(stderr, "handoff: no acknowledgement, staying up\n");
+    if (metrics_addr && httpd_open(metrics_addr, render_metrics) < 0) perror("metrics");
+    for (int k = 0; k < PEER_MAX; ++k) peer_forget_rooms(k);
+    if (peer_reopen() < 0) perror("peer-listen");
+}
+
+static bool restore_client(ho_buf_t *b, const int *fds, int nfds) {
+    uint64_t slot = ho_get_u64(b);
+    pid_t pid = (pid_t)ho_get_u64(b);
+    const char *user = ho_get_str(b);
+    const char *room = ho_get_str(b);
+    bool muted = ho_get_u64(b);
+    bool is_admin = ho_get_u64(b);
+    const char *appeal = ho_get_str(b);
+    size_t in_len;
+    const char *in = ho_get_bytes(b, &in_len);
+    if (b->bad || nfds != 2) return false;
+    /* the slot comes from the old server's blob: range-check it first */
+    if (slot >= (uint64_t)max_clients) return false;
+    int i = (int)slot;
+    if (conn_live[i]) return false;
+
+    client_t *c = &clients[i];
+    conn_in_fd[i] = fds[0];
+    conn_out_fd[i] = fds[1];
+    conn_live[i] = true;
+    c->pid = pid;
+    c->user = intern(user);
+    conn_room[i] = intern(room);
+    conn_ri[i] = room_index(conn_room[i]);
+    c->muted = muted;
+    c->is_admin = is_admin;
+    limiter_set(&c->limiter, user_limit, false);
+    idle_start(i);
+    snprintf(c->last_appeal, sizeof(c->last_appeal), "%s", appeal);
+    if (in_len > 0) {
+        c->in_buf = pool_get(in_len + 1, &c->in_cap);
+        if (!c->in_buf) return false;
+        memcpy(c->in_buf, in, in_len);
+        c->in_len = in_len;
+    }
+    for (uint64_t nseg = ho_get_u64(b); nseg > 0 && !b->bad; --nseg) {
+        size_t n;
+        const char *p = ho_get_bytes(b, &n);
+        if (p && !outq_append(i, p, n)) return false;
+    }
+    return !b->bad;
+}
+
+/* new side: take over from a server listening on path. Returns the
+   number of connections adopted, or -1 if nobody is there; exits if the
+   takeover fails halfway (the old server then keeps running). */
+static int handoff_takeover(const char *path) {
+    int sock = handoff_connect(path);
+    if (sock < 0) return -1;
+    handoff_timeouts(sock);
+
+    ho_buf_t b = {0};
+    ho_put_u64(&b, HO_VERSION);
+    bool ok = !b.bad && handoff_send(sock, HO_HELLO, b.buf, b.len, NULL, 0) == 0;
+    ho_free(&b);
+    int adopted = 0;
+    bool done = false;
+    while (ok && !done) {
+        uint32_t type;
+        void *data;
+        size_t len;
+        int fds[HO_MAX_FDS], nfds;
+        if (handoff_recv(sock, &type, &data, &len, fds, &nfds) < 0) { ok = false; break; }
+        b = (ho_buf_t){.buf = data, .len = len};
+        switch (type) {
+        case HO_LISTEN:
+            ok = ho_get_u64(&b) == HO_VERSION && !b.bad && nfds == 1;
+            if (ok) listen_fd = fds[0];
+            break;
+        case HO_ROOM: {
+            const char *name = ho_get_str(&b);
+            uint64_t msgs = ho_get_u64(&b);
+            int ri = b.bad ? -1 : add_room_if_missing(name);
+            if (ri >= 0) room_msgs[ri] = msgs;
+            ok = ri >= 0 && nfds == 0;
+            break;
+        }
+        case HO_CLIENT:
+            ok = restore_client(&b, fds, nfds);
+            if (ok) adopted++;
+            break;
+        case HO_END:
+            done = true;
+            break;
+        default:
+            ok = false;
+        }
+        if (!ok) close_fds(fds, nfds);
+        ho_free(&b);
+    }
+    if (!ok || handoff_send(sock, HO_ACK, NULL, 0, NULL, 0) < 0) {
+        fprintf(stderr, "handoff: takeover from %s failed, the old server keeps running\n", path);
+        exit(1);
+    }
+    close(sock);
+
+    free_top = 0;
+    for (int i = max_clients - 1; i >= 0; --i)
+        if (!conn_live[i]) free_slots[free_top++] = i;
+    return adopted;
+}
+
 /* ------------ HELPERS ------------ */
 int find_free_slot() {
-    for (int i = 0; i < MAX_CLIENTS; ++i)
-        if (!clients[i].connected) return i;
-    return -1;
+    return free_top > 0 ? free_slots[--free_top] : -1;
 }
 
-int find_client_by_name(const char *name) {
-    if (!name) return -1;
-    for (int i = 0; i < MAX_CLIENTS; ++i)
-        if (clients[i].connected && strcmp(clients[i].username, name) == 0)
-            return i;
-    return -1;
+/* ------------ RATE LIMITS ------------ */
+/* Every connection and every room has a message bucket and a byte
+   bucket, checked as soon as a MSG frame is parsed: a flood is dropped
+   before it reaches the filter, the log or the fan-out. Buckets refill
+   from the clock when they are checked, so idle ones cost nothing. With
+   --shards each shard limits what its own connections send. */
+static void limiter_set(limiter_t *l, rate_limit_t lim, bool custom) {
+    uint64_t now = metrics_now_ns();
+    /* the byte bucket always has room for one line of the longest size */
+    double byte_burst = (double)lim.bytes * rate_burst;
+    if (byte_burst < line_max) byte_burst = line_max;
+    tbucket_init(&l->msgs, lim.msgs, (double)lim.msgs * rate_burst, now);
+    tbucket_init(&l->bytes, lim.bytes, byte_burst, now);
+    l->limit = lim;
+    l->custom = custom;
 }
 
-/* ------------ PARENT MESSAGE HANDLER ------------ */
-void handle_parent_messages() {
-    fd_set rfds;
-    FD_ZERO(&rfds);
+/* takes one message of len bytes from both buckets, or from neither */
+static bool limiter_admit(limiter_t *l, size_t len, uint64_t now) {
+    tbucket_refill(&l->msgs, now);
+    tbucket_refill(&l->bytes, now);
+    if (tbucket_wait_ns(&l->msgs, 1) || tbucket_wait_ns(&l->bytes, len)) {
+        l->shed++;
+        return false;
+    }
+    tbucket_take(&l->msgs, 1, now);
+    tbucket_take(&l->bytes, len, now);
+    return true;
+}
+
+/* whether client i may send len bytes to room ri now; the sender hears
+   about the first drop of each run */
+static bool rate_admit(int i, int ri, const char *room, size_t len) {
+    client_t *c = &clients[i];
+    uint64_t now = metrics_now_ns();
+    const char *why = NULL;
+    limiter_t *l = NULL;
+    if (!limiter_admit(&c->limiter, len, now)) {
+        why = "You are sending too fast";
+        l = &c->limiter;
+        metric_add(M_RATE_SHED_USER, 1);
+    } else if (ri >= 0 && !limiter_admit(&room_limiters[ri], len, now)) {
+        tbucket_put(&c->limiter.msgs, 1); /* not the sender's fault */
+        tbucket_put(&c->limiter.bytes, len);
+        why = "This room is too busy";
+        l = &room_limiters[ri];
+        metric_add(M_RATE_SHED_ROOM, 1);
+    }
+    if (!why) {
+        c->throttle_noticed = false;
+        return true;
+    }
+    if (!c->throttle_noticed) {
+        client_printf(i, "%s, messages to %s are being dropped\n", why, room);
+        /* say when a message like this one would get through */
+        uint64_t wait = tbucket_wait_ns(&l->msgs, 1), wb = tbucket_wait_ns(&l->bytes, len);
+        twheel_arm(&c->rate_timer, (wait > wb ? wait : wb) / 1000000);
+    }
+    c->throttle_noticed = true;
+    return false;
+}
+
+static void rate_resume(twheel_timer_t *t) {
+    int i = (int)(intptr_t)t->arg;
+    if (!conn_live[i] || !clients[i].throttle_noticed) return;
+    clients[i].throttle_noticed = false;
+    client_printf(i, "You can send again\n");
+}
+
+/* "MSGS" or "MSGS,BYTES" per second; bytes stay as they were when left out */
+static int parse_rate(const char *arg, rate_limit_t *lim) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%s", arg);
+    char *comma = strchr(buf, ',');
+    if (comma) *comma = '\0';
+    long m = parse_num(buf, 0, 1000000);
+    /* M alone keeps the byte rate, except a bare 0: "no limit" at all */
+    long b = comma ? parse_num(comma + 1, 0, 1L << 30) : m == 0 ? 0 : (long)lim->bytes;
+    if (m < 0 || b < 0) return -1;
+    lim->msgs = m;
+    lim->bytes = b;
+    return 0;
+}
 
-    int maxfd = -1;
-    for (int i = 0; i < MAX_CLIENTS; ++i) {
-        if (clients[i].connected) {
-            FD_SET(clients[i].from_child_fd, &rfds);
-            if (clients[i].from_child_fd > maxfd) maxfd = clients[i].from_child_fd;
+static const char *fmt_rate(rate_limit_t lim) {
+    if (!lim.msgs && !lim.bytes) return "unlimited";
+    return arena_printf(NULL, "%s msg/s, %s B/s",
+                        lim.msgs ? arena_printf(NULL, "%u", lim.msgs) : "any",
+                        lim.bytes ? arena_printf(NULL, "%u", lim.bytes) : "any");
+}
+
+/* admin LIMITS: defaults, then every limiter that is custom or dropping */
+static void show_limits(int i) {
+    client_printf(i, "Rate limits (burst %us):\n users: %s\n rooms: %s\n", rate_burst,
+                  fmt_rate(user_limit), fmt_rate(room_limit));
+    for (int k = 0; k < max_clients; ++k) {
+        limiter_t *l = &clients[k].limiter;
+        if (conn_live[k] && clients[k].user && (l->custom || l->shed))
+            client_printf(i, " user %s: %s%s, %llu dropped\n", atom_str(clients[k].user),
+                          fmt_rate(l->limit), l->custom ? " (custom)" : "", (unsigned long long)l->shed);
+    }
+    for (int r = 0; r < room_count; ++r) {
+        limiter_t *l = &room_limiters[r];
+        if (l->custom || l->shed)
+            client_printf(i, " room %s: %s%s, %llu dropped\n", atom_str(rooms[r]),
+                          fmt_rate(l->limit), l->custom ? " (custom)" : "", (unsigned long long)l->shed);
+    }
+}
+
+/* admin LIMIT USER|ROOM <name|*> <MSGS[,BYTES]|DEFAULT>, or LIMIT BURST <secs> */
+static void set_limit(int i, char *args) {
+    char *save = NULL;
+    char *kind = args ? strtok_r(args, " ", &save) : NULL;
+    char *name = kind ? strtok_r(NULL, " ", &save) : NULL;
+    char *rate = name ? strtok_r(NULL, " ", &save) : NULL;
+    if (kind && name && strcmp(kind, "BURST") == 0) {
+        long v = parse_num(name, 1, 3600);
+        if (v < 0) { client_printf(i, "LIMIT BURST needs 1-3600 seconds\n"); return; }
+        rate_burst = v;
+        for (int k = 0; k < max_clients; ++k)
+            if (conn_live[k]) limiter_set(&clients[k].limiter, clients[k].limiter.limit, clients[k].limiter.custom);
+        for (int r = 0; r < room_count; ++r)
+            limiter_set(&room_limiters[r], room_limiters[r].limit, room_limiters[r].custom);
+        client_printf(i, "Burst set to %lds\n", v);
+        return;
+    }
+    bool user = kind && strcmp(kind, "USER") == 0, room = kind && strcmp(kind, "ROOM") == 0;
+    if ((!user && !room) || !rate) {
+        client_printf(i, "Usage: LIMIT USER|ROOM <name|*> <msgs[,bytes]|DEFAULT> or LIMIT BURST <secs>\n");
+        return;
+    }
+    rate_limit_t *dflt = user ? &user_limit : &room_limit;
+    bool reset = strcmp(rate, "DEFAULT") == 0;
+    rate_limit_t lim = *dflt;
+    if (!reset && parse_rate(rate, &lim) < 0) { client_printf(i, "Bad rate %s\n", rate); return; }
+
+    if (strcmp(name, "*") == 0) {
+        /* new default, for everyone without a limit of their own */
+        *dflt = lim;
+        if (user) {
+            for (int k = 0; k < max_clients; ++k)
+                if (conn_live[k] && !clients[k].limiter.custom) limiter_set(&clients[k].limiter, lim, false);
+        } else {
+            for (int r = 0; r < room_count; ++r)
+                if (!room_limiters[r].custom) limiter_set(&room_limiters[r], lim, false);
         }
+        client_printf(i, "Default %s limit: %s\n", user ? "user" : "room", fmt_rate(lim));
+        return;
     }
-    if (maxfd < 0) return;
+    limiter_t *l = NULL;
+    if (user) {
+        int idx = find_client_by_name(name);
+        if (idx >= 0) l = &clients[idx].limiter;
+    } else {
+        int ri = room_index(intern_lookup(name));
+        if (ri >= 0) l = &room_limiters[ri];
+    }
+    if (!l) { client_printf(i, "%s %s not found\n", user ? "User" : "Room", name); return; }
+    limiter_set(l, lim, !reset);
+    client_printf(i, "Limit for %s: %s\n", name, fmt_rate(lim));
+}
 
-    struct timeval tv = {0, 300000};
-    int rv = select(maxfd + 1, &rfds, NULL, NULL, &tv);
-    if (rv <= 0) return;
+/* ------------ TIMERS ------------ */
+/* Everything that waits goes on one timing wheel (twheel.c), advanced
+   once per loop pass: per-connection keepalive and idle checks, the
+   "you can send again" notice after rate-limit drops, and reopening the
+   listener once admission has a token again. Activity only stamps
+   last_active_ms; the idle timer notices when it fires and re-arms for
+   the remainder, so busy connections never touch the wheel. */
+static uint64_t clock_ms(void) {
+    return metrics_now_ns() / 1000000;
+}
 
-    char buf[BUF];
-    for (int i = 0; i < MAX_CLIENTS; ++i) {
-        if (!clients[i].connected) continue;
-        if (!FD_ISSET(clients[i].from_child_fd, &rfds)) continue;
+static void idle_schedule(int i) {
+    client_t *c = &clients[i];
+    uint64_t due = UINT64_MAX;
+    if (idle_timeout) due = c->last_active_ms + idle_timeout * 1000ULL;
+    if (keepalive) {
+        uint64_t from = c->last_ping_ms > c->last_active_ms ? c->last_ping_ms : c->last_active_ms;
+        if (from + keepalive * 1000ULL < due) due = from + keepalive * 1000ULL;
+    }
+    if (due == UINT64_MAX) twheel_cancel(&c->idle_timer);
+    else twheel_arm(&c->idle_timer, due > loop_ms ? due - loop_ms : 0);
+}
 
-        ssize_t n = read(clients[i].from_child_fd, buf, sizeof(buf) - 1);
-        if (n <= 0) {
-            close(clients[i].from_child_fd);
-            close(clients[i].to_child_fd);
-            clients[i].connected = false;
-            continue;
+/* a new or adopted connection starts its idle clock now */
+static void idle_start(int i) {
+    clients[i].last_active_ms = clients[i].last_ping_ms = loop_ms;
+    idle_schedule(i);
+}
+
+static void idle_check(twheel_timer_t *t) {
+    int i = (int)(intptr_t)t->arg;
+    client_t *c = &clients[i];
+    if (!conn_live[i]) return;
+    uint64_t quiet = loop_ms - c->last_active_ms;
+    if (idle_timeout && quiet >= idle_timeout * 1000ULL) {
+        client_printf(i, "Disconnected after %u seconds without a reply\n", idle_timeout);
+        metric_add(M_IDLE_DISCONNECTS, 1);
+        disconnect_client(i);
+        return;
+    }
+    if (keepalive && quiet >= keepalive * 1000ULL && loop_ms - c->last_ping_ms >= keepalive * 1000ULL) {
+        client_printf(i, "PING\n"); /* answered with /pong by our clients */
+        c->last_ping_ms = loop_ms;
+        metric_add(M_PINGS, 1);
+    }
+    idle_schedule(i);
+}
+
+/* ------------ PARENT MESSAGE HANDLER ------------ */
+/* one complete frame (no trailing newline) from client i's child */
+static void handle_frame(int i, char *buf) {
+    char *save = NULL;
+    char *cmd = strtok_r(buf, "|", &save);
+    if (!cmd) return;
+
+    switch (cmd_lookup(CMD_LAYER_FRAME, cmd, strlen(cmd))) {
+    case CMD_JOIN: {
+        char *username = strtok_r(NULL, "|", &save);
+        char *room = strtok_r(NULL, "|", &save);
+        if (!username || !room) return;
+        atom_t u = intern(username), r = intern(room), old = conn_room[i];
+        atom_unref(clients[i].user);
+        clients[i].user = u;
+        conn_room[i] = r;
+        room_presence(old, r);
+        atom_unref(old);
+        int known = room_count;
+        int ri = add_room_if_missing(room);
+        conn_ri[i] = ri;
+        if (room_count > known && bus_shards() > 1) announce_room(room);
+        client_printf(i, "Welcome %s to %s\n", username, room);
+        if (old != r) {
+            if (history_preload) history_preload_send(i, ri);
+            presence_add(room_index(old), 0, 1);
+            presence_add(ri, 1, 0);
         }
-        buf[n] = '\0';
-        trim_newline(buf);
-
-        char *save = NULL;
-        char *cmd = strtok_r(buf, "|", &save);
-        if (!cmd) continue;
-
-        if (strcmp(cmd, "JOIN") == 0) {
-            char *username = strtok_r(NULL, "|", &save);
-            char *room = strtok_r(NULL, "|", &save);
-            if (!username || !room) continue;
-            strncpy(clients[i].username, username, sizeof(clients[i].username)-1);
-            strncpy(clients[i].room, room, sizeof(clients[i].room)-1);
-            add_room_if_missing(room);
-            writef(clients[i].to_child_fd, "Welcome %s to %s\n", username, room);
-            broadcast_to_room(room, "server", "a new user has joined");
-        }
-
-        else if (strcmp(cmd, "MSG") == 0) {
-            char *username = strtok_r(NULL, "|", &save);
-            char *room = strtok_r(NULL, "|", &save);
-            char *message = strtok_r(NULL, "|", &save);
-            if (!username || !room || !message) continue;
-            if (clients[i].muted) writef(clients[i].to_child_fd, "You are muted.\n");
-            else broadcast_to_room(room, username, message);
-        }
-
-        else if (strcmp(cmd, "PM") == 0) {
-            char *from = strtok_r(NULL, "|", &save);
-            char *to = strtok_r(NULL, "|", &save);
-            char *message = strtok_r(NULL, "|", &save);
-            if (!from || !to || !message) continue;
-            if (!send_private(from, to, message))
-                writef(clients[i].to_child_fd, "User %s not found\n", to);
-            else
-                writef(clients[i].to_child_fd, "PM sent to %s\n", to);
-        }
-        
-        else if (strcmp(cmd, "APPEAL") == 0) {
-            /* APPEAL|from|message  -> forward to all admins only, with deduping per-sender */
-            char *from = strtok_r(NULL, "|", &save);
-            char *message = strtok_r(NULL, "\n", &save);
-            if (!from || !message) continue;
-            int sender_idx = find_client_by_name(from);
-            /* dedupe: if the same message already forwarded for this sender, skip */
-            if (sender_idx >= 0 && last_appeal_msg[sender_idx][0] != '\0' && strcmp(last_appeal_msg[sender_idx], message) == 0) {
-                /* already forwarded recently */
-                writef(clients[i].to_child_fd, "Your appeal was already sent to admins recently.\n");
-                continue;
-            }
-            /* store last appeal for this sender */
-            if (sender_idx >= 0) {
-                strncpy(last_appeal_msg[sender_idx], message, sizeof(last_appeal_msg[sender_idx]) - 1);
-                last_appeal_msg[sender_idx][sizeof(last_appeal_msg[sender_idx]) - 1] = '\0';
-            }
-            int sent = 0;
-            for (int k = 0; k < MAX_CLIENTS; ++k) {
-                if (clients[k].connected && clients[k].is_admin) {
-                    writef(clients[k].to_child_fd, "[APPEAL] %s: %s\n", from, message);
-                    sent++;
-                    /* server-side log for demo visibility */
-                    printf("Forwarded APPEAL from '%s' to admin slot %d (user='%s', room='%s')\n",
-                           from, k, clients[k].username[0] ? clients[k].username : "(unnamed)",
-                           clients[k].room[0] ? clients[k].room : "(none)");
-                }
+        break;
+    }
+
+    case CMD_TS: {
+        /* TS|<ns>: when the child read the next MSG off the socket */
+        char *ns = strtok_r(NULL, "|", &save);
+        clients[i].trace_recv_ns = ns ? strtoull(ns, NULL, 10) : 0;
+        break;
+    }
+
+    case CMD_MSG: {
+        char *username = strtok_r(NULL, "|", &save);
+        char *room = strtok_r(NULL, "|", &save);
+        char *message = strtok_r(NULL, "|", &save);
+        uint64_t recv_ns = clients[i].trace_recv_ns;
+        clients[i].trace_recv_ns = 0;
+        if (!username || !room || !message) return;
+        if (clients[i].muted) client_printf(i, "You are muted.\n");
+        else if (rate_admit(i, add_room_if_missing(room), room, strlen(message))) {
+            uint64_t t0 = metrics_now_ns();
+            tracing = trace_should_sample();
+            if (tracing) {
+                memset(&cur_trace, 0, sizeof(cur_trace));
+                cur_trace.ts[TS_RECV] = recv_ns;
+                cur_trace.ts[TS_PARSE] = t0;
             }
-            if (sent == 0) {
-                writef(clients[i].to_child_fd, "No admins currently online. Try again later.\n");
-            } else {
-                writef(clients[i].to_child_fd, "Your appeal was sent to %d admin(s).\n", sent);
+            broadcast_to_room(room, username, message);
+            metric_record(H_ROUTE_NS, metrics_now_ns() - t0);
+            if (tracing) trace_submit(&cur_trace);
+            tracing = false;
+        }
+        break;
+    }
+
+    case CMD_PM: {
+        char *from = strtok_r(NULL, "|", &save);
+        char *to = strtok_r(NULL, "|", &save);
+        char *message = strtok_r(NULL, "|", &save);
+        if (!from || !to || !message) return;
+        if (send_private(from, to, message))
+            client_printf(i, "PM sent to %s\n", to);
+        else if (bus_shards() > 1)
+            pm_remote(i, from, to, message);
+        else
+            client_printf(i, "User %s not found\n", to);
+        break;
+    }
+
+    case CMD_APPEAL: {
+        /* APPEAL|from|message  -> forward to all admins only, with deduping per-sender */
+        char *from = strtok_r(NULL, "|", &save);
+        char *message = strtok_r(NULL, "\n", &save);
+        if (!from || !message) return;
+        int sender_idx = find_client_by_name(from);
+        /* dedupe: if the same message already forwarded for this sender, skip */
+        if (sender_idx >= 0 && clients[sender_idx].last_appeal[0] != '\0' && strcmp(clients[sender_idx].last_appeal, message) == 0) {
+            /* already forwarded recently */
+            client_printf(i, "Your appeal was already sent to admins recently.\n");
+            return;
+        }
+        /* store last appeal for this sender */
+        if (sender_idx >= 0) {
+            strncpy(clients[sender_idx].last_appeal, message, sizeof(clients[sender_idx].last_appeal) - 1);
+            clients[sender_idx].last_appeal[sizeof(clients[sender_idx].last_appeal) - 1] = '\0';
+        }
+        int sent = 0;
+        for (int k = 0; k < max_clients; ++k) {
+            if (conn_live[k] && clients[k].is_admin) {
+                client_printf(k, "[APPEAL] %s: %s\n", from, message);
+                sent++;
+                /* server-side log for demo visibility */
+                printf("Forwarded APPEAL from '%s' to admin slot %d (user='%s', room='%s')\n",
+                       from, k, clients[k].user ? atom_str(clients[k].user) : "(unnamed)",
+                       conn_room[k] ? atom_str(conn_room[k]) : "(none)");
             }
         }
+        if (sent == 0) {
+            client_printf(i, "No admins currently online. Try again later.\n");
+        } else {
+            client_printf(i, "Your appeal was sent to %d admin(s).\n", sent);
+        }
+        break;
+    }
 
+    case CMD_HISTORY: {
+        char *room = strtok_r(NULL, "|", &save);
+        if (!room) return;
+        metric_add(M_HISTORY_READS, 1);
+        logstore_stats_t st;
+        if (logstore_scan(logdir, room, history_write_chunk, &i, &st) < 0)
+            client_printf(i, "No history for %s\n", room);
+        else report_history_stats(room, &st);
+        break;
+    }
 
+    case CMD_MORE: {
+        char *room = strtok_r(NULL, "|", &save);
+        if (room) history_more(i, add_room_if_missing(room));
+        break;
+    }
 
-        else if (strcmp(cmd, "HISTORY") == 0) {
-            char *room = strtok_r(NULL, "|", &save);
-            if (!room) continue;
-            char path[256];
-            snprintf(path, sizeof(path), "%s/%s.log", LOGDIR, room);
-            int fd = open(path, O_RDONLY);
-            if (fd < 0) writef(clients[i].to_child_fd, "No history for %s\n", room);
-            else {
-                char rbuf[1024];
-                ssize_t rn;
-                while ((rn = read(fd, rbuf, sizeof(rbuf))) > 0)
-                    write(clients[i].to_child_fd, rbuf, rn);
-                close(fd);
-            }
+    case CMD_SEARCH: {
+        char *room = strtok_r(NULL, "|", &save);
+        char *needle = strtok_r(NULL, "\n", &save);
+        if (!room || !needle || !needle[0]) return;
+        logstore_stats_t st;
+        search_ctx_t sc = { i, needle, 0 };
+        if (logstore_scan(logdir, room, search_chunk, &sc, &st) < 0)
+            client_printf(i, "No history for %s\n", room);
+        else {
+            client_printf(i, "%d match(es) in %s\n", sc.hits, room);
+            report_history_stats(room, &st);
         }
+        break;
+    }
 
-        else if (strcmp(cmd, "ROOMS") == 0) {
-            if (room_count == 0) writef(clients[i].to_child_fd, "No rooms\n");
-            else for (int r = 0; r < room_count; ++r) writef(clients[i].to_child_fd, "%s\n", rooms[r]);
-        }
-
-        else if (strcmp(cmd, "QUIT") == 0) {
-            writef(clients[i].to_child_fd, "Goodbye\n");
-            close(clients[i].from_child_fd);
-            close(clients[i].to_child_fd);
-            clients[i].connected = false;
-        }
-
-        else if (strcmp(cmd, "ADMIN") == 0) {
-            /* Robust ADMIN parsing:
-               Accept either:
-                 ADMIN|username|password|ACTION|args...
-               or:
-                 ADMIN|username|password ACTION args...
-            */
-            char *username = strtok_r(NULL, "|", &save);
-            char *third = strtok_r(NULL, "|", &save); /* may contain password OR "password ACTION..." */
-            char *action = strtok_r(NULL, "|", &save); /* null if the client used space-separated form */
-
-            if (!username || !third) { writef(clients[i].to_child_fd, "Admin malformed\n"); continue; }
-
-            /* If action is NULL, try to split third by first space into password and action+args */
-            char *password = NULL;
-            char *action_with_args = NULL;
-
-            if (action == NULL) {
-                /* attempt space-split on 'third' */
-                char *sp = strchr(third, ' ');
-                if (sp) {
-                    *sp = '\0';
-                    password = third;
-                    action_with_args = sp + 1;
-                } else {
-                    /* only password provided (no action) */
-                    password = third;
-                    action_with_args = NULL;
-                }
+    case CMD_ROOMS: {
+        if (room_count == 0) client_printf(i, "No rooms\n");
+        else for (int r = 0; r < room_count; ++r) client_printf(i, "%s\n", atom_str(rooms[r]));
+        break;
+    }
+
+    case CMD_PONG:
+        break; /* read_frames already counted it as activity */
+
+    case CMD_QUIT: {
+        client_printf(i, "Goodbye\n");
+        disconnect_client(i);
+        break;
+    }
+
+    case CMD_ADMIN: {
+        /* Robust ADMIN parsing:
+           Accept either:
+             ADMIN|username|password|ACTION|args...
+           or:
+             ADMIN|username|password ACTION args...
+        */
+        char *username = strtok_r(NULL, "|", &save);
+        char *third = strtok_r(NULL, "|", &save); /* may contain password OR "password ACTION..." */
+        char *action = strtok_r(NULL, "|", &save); /* null if the client used space-separated form */
+
+        if (!username || !third) { client_printf(i, "Admin malformed\n"); return; }
+
+        /* If action is NULL, try to split third by first space into password and action+args */
+        char *password = NULL;
+        char *action_with_args = NULL;
+
+        if (action == NULL) {
+            /* attempt space-split on 'third' */
+            char *sp = strchr(third, ' ');
+            if (sp) {
+                *sp = '\0';
+                password = third;
+                action_with_args = sp + 1;
             } else {
+                /* only password provided (no action) */
                 password = third;
-                action_with_args = action;
+                action_with_args = NULL;
             }
+        } else {
+            password = third;
+            action_with_args = action;
+        }
 
-            if (!password) { writef(clients[i].to_child_fd, "Admin malformed\n"); continue; }
-
-            /* extract action word and optional args */
-            char *action_word = NULL;
-            char *action_args = NULL;
-            if (action_with_args) {
-                char *sp2 = strchr(action_with_args, ' ');
-                if (sp2) {
-                    *sp2 = '\0';
-                    action_word = action_with_args;
-                    action_args = sp2 + 1;
-                } else {
-                    action_word = action_with_args;
-                    action_args = NULL;
-                }
+        if (!password) { client_printf(i, "Admin malformed\n"); return; }
+
+        /* extract action word and optional args */
+        char *action_word = NULL;
+        char *action_args = NULL;
+        if (action_with_args) {
+            char *sp2 = strchr(action_with_args, ' ');
+            if (sp2) {
+                *sp2 = '\0';
+                action_word = action_with_args;
+                action_args = sp2 + 1;
+            } else {
+                action_word = action_with_args;
+                action_args = NULL;
             }
+        }
 
-            /* authenticate */
-            if (strcmp(password, ADMIN_PASSWORD) != 0) {
-                writef(clients[i].to_child_fd, "Admin auth failed\n");
-                continue;
-            }
-            /* mark this client as an admin so they can receive appeals */
-            clients[i].is_admin = true;
-            /* mark this client as an admin so they can receive appeals */
-            clients[i].is_admin = true;
-
-            if (!action_word) { writef(clients[i].to_child_fd, "Admin: no action\n"); continue; }
-
-            if (strcmp(action_word, "KICK") == 0) {
-                char *target = action_args ? action_args : strtok_r(NULL, "|", &save);
-                if (!target) { writef(clients[i].to_child_fd, "KICK requires username\n"); continue; }
-                int idx = find_client_by_name(target);
-                if (idx >= 0) {
-                    writef(clients[idx].to_child_fd, "You have been kicked by admin\n");
-                    close(clients[idx].from_child_fd);
-                    close(clients[idx].to_child_fd);
-                    clients[idx].connected = false;
-                } else writef(clients[i].to_child_fd, "User not found\n");
-            }
+        /* authenticate */
+        if (strcmp(password, admin_password) != 0) {
+            client_printf(i, "Admin auth failed\n");
+            return;
+        }
+        /* mark this client as an admin so they can receive appeals */
+        clients[i].is_admin = true;
+        /* mark this client as an admin so they can receive appeals */
+        clients[i].is_admin = true;
+
+        if (!action_word) { client_printf(i, "Admin: no action\n"); return; }
+
+        switch (cmd_lookup(CMD_LAYER_ADMIN, action_word, strlen(action_word))) {
+        case ADM_KICK: {
+            char *target = action_args ? action_args : strtok_r(NULL, "|", &save);
+            if (!target) { client_printf(i, "KICK requires username\n"); return; }
+            int idx = find_client_by_name(target);
+            if (idx >= 0) {
+                client_printf(idx, "You have been kicked by admin\n");
+                disconnect_client(idx);
+            } else client_printf(i, "User not found\n");
+            break;
+        }
 
-            else if (strcmp(action_word, "MUTE") == 0) {
-                char *target = action_args ? action_args : strtok_r(NULL, "|", &save);
-                if (!target) { writef(clients[i].to_child_fd, "MUTE requires username\n"); continue; }
-                int idx = find_client_by_name(target);
-                if (idx >= 0) { clients[idx].muted = true; writef(clients[idx].to_child_fd, "You are muted by admin\n"); }
-                else writef(clients[i].to_child_fd, "User not found\n");
-            }
+        case ADM_MUTE: {
+            char *target = action_args ? action_args : strtok_r(NULL, "|", &save);
+            if (!target) { client_printf(i, "MUTE requires username\n"); return; }
+            int idx = find_client_by_name(target);
+            if (idx >= 0) { clients[idx].muted = true; client_printf(idx, "You are muted by admin\n"); }
+            else client_printf(i, "User not found\n");
+            break;
+        }
 
-            else if (strcmp(action_word, "UNMUTE") == 0) {
-                char *target = action_args ? action_args : strtok_r(NULL, "|", &save);
-                if (!target) { writef(clients[i].to_child_fd, "UNMUTE requires username\n"); continue; }
-                int idx = find_client_by_name(target);
-                if (idx >= 0) { clients[idx].muted = false; writef(clients[idx].to_child_fd, "You are unmuted by admin\n"); }
-                else writef(clients[i].to_child_fd, "User not found\n");
-            }
+        case ADM_UNMUTE: {
+            char *target = action_args ? action_args : strtok_r(NULL, "|", &save);
+            if (!target) { client_printf(i, "UNMUTE requires username\n"); return; }
+            int idx = find_client_by_name(target);
+            if (idx >= 0) { clients[idx].muted = false; client_printf(idx, "You are unmuted by admin\n"); }
+            else client_printf(i, "User not found\n");
+            break;
+        }
 
-            else if (strcmp(action_word, "BROADCAST") == 0) {
-                char *msg = action_args ? action_args : strtok_r(NULL, "|", &save);
-                if (!msg) msg = "";
-                broadcast_to_room("global", "admin", msg);
-            }
-            else if (strcmp(action_word, "ROOMS") == 0) {
-                if (room_count == 0) {
-                    writef(clients[i].to_child_fd, "No rooms\n");
-                } else {
-                    writef(clients[i].to_child_fd, "Rooms (%d):\n", room_count);
-                    for (int r = 0; r < room_count; ++r) {
-                        writef(clients[i].to_child_fd, " - %s\n", rooms[r]);
-                    }
+        case ADM_BROADCAST: {
+            char *msg = action_args ? action_args : strtok_r(NULL, "|", &save);
+            if (!msg) msg = "";
+            broadcast_to_room("global", "admin", msg);
+            break;
+        }
+
+        case ADM_ROOMS: {
+            if (room_count == 0) {
+                client_printf(i, "No rooms\n");
+            } else {
+                client_printf(i, "Rooms (%d):\n", room_count);
+                for (int r = 0; r < room_count; ++r) {
+                    client_printf(i, " - %s\n", atom_str(rooms[r]));
                 }
             }
+            break;
+        }
+
+        case ADM_STATS: {
+            size_t len;
+            char *text = format_stats(&len);
+            if (text) client_send(i, text, len);
+            break;
+        }
+
+        case ADM_TRACE: {
+            /* TRACE [n|DUMP]: breakdown, set the sampling rate, or write the ring out */
+            if (action_args && strcmp(action_args, "DUMP") == 0) {
+                char *path = arena_printf(NULL, "%s/trace-%d.txt", logdir, (int)getpid());
+                int n = path ? trace_dump(path) : -1;
+                if (n < 0) client_printf(i, "Trace dump failed\n");
+                else client_printf(i, "Wrote %d trace records to %s\n", n, path);
+            } else {
+                if (action_args) trace_set_sample((unsigned)strtoul(action_args, NULL, 10));
+                size_t cap = 4096;
+                char *text = arena_alloc(cap);
+                if (text) client_send(i, text, trace_format(text, cap));
+            }
+            break;
+        }
 
+        case ADM_RELOADFILTER: {
+            reload_filter(i);
+            break;
+        }
 
-            else if (strcmp(action_word, "USERS") == 0) {
-                int active = 0;
-                for (int k = 0; k < MAX_CLIENTS; ++k)
-                    if (clients[k].connected) active++;
+        case ADM_LIMITS:
+            show_limits(i);
+            break;
 
-                writef(clients[i].to_child_fd, "Active users: %d\n", active);
+        case ADM_LIMIT:
+            set_limit(i, action_args);
+            break;
 
-                for (int k = 0; k < MAX_CLIENTS; ++k) {
-                    if (clients[k].connected && clients[k].username[0]) {
-                        writef(clients[i].to_child_fd,
-                               " - %s (room: %s)\n",
-                               clients[k].username,
-                               clients[k].room[0] ? clients[k].room : "none");
-                    }
+        case ADM_USERS: {
+            int active = 0;
+            for (int k = 0; k < max_clients; ++k)
+                if (conn_live[k]) active++;
+
+            client_printf(i, "Active users: %d\n", active);
+
+            for (int k = 0; k < max_clients; ++k) {
+                if (conn_live[k] && clients[k].user) {
+                    client_printf(i, " - %s (room: %s)\n",
+                           atom_str(clients[k].user),
+                           conn_room[k] ? atom_str(conn_room[k]) : "none");
                 }
             }
-  
-            
+            break;
+        }
 
+        default:
+            client_printf(i, "Unknown admin action: %s\n", action_word);
+            break;
+        }
+        break;
+    }
 
-            else {
-                writef(clients[i].to_child_fd, "Unknown admin action: %s\n", action_word);
-            }
+    default:
+        client_printf(i, "Unknown command: %s\n", cmd);
+        break;
+    }
+}
+
+/* pull bytes from client i's child and dispatch every complete frame */
+static void read_frames(int i) {
+    client_t *c = &clients[i];
+    if (!c->in_buf) {
+        c->in_buf = pool_get(pool_class_size[0], &c->in_cap);
+        if (!c->in_buf) return;
+    } else if (c->in_len == c->in_cap - 1 && pool_class(c->in_cap + 1) >= 0) {
+        /* partial frame filled its buffer: move up a size class */
+        size_t cap;
+        char *nb = pool_get(c->in_cap + 1, &cap);
+        if (nb) {
+            memcpy(nb, c->in_buf, c->in_len);
+            pool_put(c->in_buf, c->in_cap);
+            c->in_buf = nb;
+            c->in_cap = cap;
         }
+    }
 
-        else {
-            writef(clients[i].to_child_fd, "Unknown command: %s\n", cmd);
+    ssize_t n = read(conn_in_fd[i], c->in_buf + c->in_len, c->in_cap - 1 - c->in_len);
+    if (n <= 0) {
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) return;
+        disconnect_client(i);
+        return;
+    }
+    c->in_len += n;
+    c->last_active_ms = loop_ms;
+    metric_add(M_BYTES_IN, n);
+
+    size_t pos = 0;
+    while (conn_live[i] && pos < c->in_len) {
+        char *start = c->in_buf + pos;
+        char *nl = memchr(start, '\n', c->in_len - pos);
+        if (!nl) {
+            /* only an over-long frame in the largest buffer is cut short */
+            if (pos > 0 || c->in_len < c->in_cap - 1 || pool_class(c->in_cap + 1) >= 0) break;
+            nl = c->in_buf + c->in_len;
         }
+        size_t len = nl - start;
+        pos += len + (nl < c->in_buf + c->in_len);
+        start[len] = '\0';
+        /* command name for the flight recorder, before strtok_r cuts it up */
+        char tag[FR_TAG_LEN];
+        size_t tl = strcspn(start, "|");
+        if (tl > FR_TAG_LEN) tl = FR_TAG_LEN;
+        memcpy(tag, start, tl);
+        if (tl < FR_TAG_LEN) tag[tl] = '\0';
+        uint64_t t0 = metrics_now_ns();
+        handle_frame(i, start);
+        flightrec_log(FR_FRAME, i, tag, 0, metrics_now_ns() - t0);
+    }
+    if (!conn_live[i]) return;
+
+    memmove(c->in_buf, c->in_buf + pos, c->in_len - pos);
+    c->in_len -= pos;
+    if (c->in_len == 0) {
+        pool_put(c->in_buf, c->in_cap);
+        c->in_buf = NULL;
+        c->in_cap = 0;
     }
 }
 
-/* ------------ ACCEPT & SPAWN CHILD ------------ */
-void accept_and_spawn() {
-    struct sockaddr_in cli;
-    socklen_t sz = sizeof(cli);
-    int ns = accept(listen_fd, (struct sockaddr *)&cli, &sz);
-    if (ns < 0) return;
+void handle_parent_messages(fd_set *rfds, fd_set *wfds) {
+    for (int i = 0; i < max_clients; ++i) {
+        if (!conn_live[i]) continue;
+        if (FD_ISSET(conn_in_fd[i], rfds)) read_frames(i);
+        if (conn_live[i] && FD_ISSET(conn_out_fd[i], wfds)) client_flush(i);
+    }
+}
 
+/* ------------ ACCEPT & SPAWN CHILD ------------ */
+/* ns is a new, non-blocking connection; the child gets it in blocking mode */
+static void spawn_client(int ns) {
     int slot = find_free_slot();
     if (slot < 0) {
         write(ns, "Server full\n", 12);
@@ -513,13 +2232,29 @@ void accept_and_spawn() {
     }
 
     int p2c[2], c2p[2];
-    if (pipe(p2c) < 0 || pipe(c2p) < 0) { close(ns); return; }
+    if (pipe(p2c) < 0 || pipe(c2p) < 0) { close(ns); free_slots[free_top++] = slot; return; }
 
     pid_t pid = fork();
-    if (pid < 0) { close(ns); return; }
+    if (pid < 0) {
+        close(ns);
+        close(p2c[0]); close(p2c[1]); close(c2p[0]); close(c2p[1]);
+        free_slots[free_top++] = slot;
+        return;
+    }
 
     if (pid == 0) {
         close(p2c[1]); close(c2p[0]);
+        fcntl(ns, F_SETFL, fcntl(ns, F_GETFL) & ~O_NONBLOCK);
+        /* other connections' pipes: holding them would keep those
+           children from seeing EOF when the parent drops them */
+        for (int k = 0; k < max_clients; ++k)
+            if (conn_live[k]) { close(conn_in_fd[k]); close(conn_out_fd[k]); }
+        httpd_close();
+        filterpool_detach();
+        bus_detach();
+        peer_close();
+        if (handoff_fd >= 0) close(handoff_fd);
+        flightrec_detach();
         int readfd = p2c[0];
         int writefd = c2p[1];
         int sock = ns;
@@ -528,7 +2263,13 @@ void accept_and_spawn() {
         char room[64] = "lobby";
         add_room_if_missing("lobby");
 
-        char buf[BUF];
+        size_t bufsz = line_max;
+        char *buf = malloc(bufsz);
+        char *inbuf = malloc(bufsz); /* socket bytes not yet split into lines */
+        char *out = malloc(bufsz);
+        char *msg_trunc = malloc(bufsz);
+        if (!buf || !inbuf || !out || !msg_trunc) _exit(1);
+        size_t inlen = 0;
 
         while (1) {
             fd_set st;
@@ -544,82 +2285,121 @@ void accept_and_spawn() {
             }
 
             if (FD_ISSET(readfd, &st)) {
-                ssize_t n = read(readfd, buf, sizeof(buf) - 1);
+                ssize_t n = read(readfd, buf, bufsz - 1);
                 if (n <= 0) break;
                 write(sock, buf, n);
             }
 
             if (FD_ISSET(sock, &st)) {
-                ssize_t n = read(sock, buf, sizeof(buf) - 1);
+                ssize_t n = read(sock, inbuf + inlen, bufsz - 1 - inlen);
                 if (n <= 0) {
                     write(writefd, "QUIT|\n", 6);
                     break;
                 }
-                buf[n] = '\0';
-                trim_newline(buf);
-
-                if (buf[0] == '/') {
-                    if (!strncmp(buf, "/nick ", 6)) {
-                        strncpy(username, buf + 6, sizeof(username)-1);
-                        char out[BUF];
-                        snprintf(out, sizeof(out), "JOIN|%s|%s\n", username, room);
-                        write(writefd, out, strlen(out));
-                    } else if (!strncmp(buf, "/join ", 6)) {
-                        strncpy(room, buf + 6, sizeof(room)-1);
-                        char out[BUF];
-                        snprintf(out, sizeof(out), "JOIN|%s|%s\n", username, room);
-                        write(writefd, out, strlen(out));
-                    } else if (!strcmp(buf, "/rooms")) {
-                        write(writefd, "ROOMS|\n", 7);
-                    } else if (!strcmp(buf, "/history")) {
-                        char out[BUF];
-                        snprintf(out, sizeof(out), "HISTORY|%s\n", room);
-                        write(writefd, out, strlen(out));
-                    } else if (!strncmp(buf, "/pm ", 4)) {
-                        char *rest = buf + 4;
-                        char *sp = strchr(rest, ' ');
-                        if (!sp) write(sock, "Usage: /pm <user> <msg>\n", 25);
-                        else {
-                            *sp = '\0';
-                            char *to = rest;
-                            char *msg = sp + 1;
-                            char out[BUF];
-                            snprintf(out, sizeof(out), "PM|%s|%s|%s\n", username, to, msg);
+                inlen += n;
+                uint64_t recv_ns = trace_sample() ? metrics_now_ns() : 0;
+
+                /* handle every complete line; keep a partial tail for the next read */
+                bool quit = false;
+                size_t pos = 0;
+                while (!quit && pos < inlen) {
+                    char *nl = memchr(inbuf + pos, '\n', inlen - pos);
+                    if (!nl) {
+                        if (pos > 0 || inlen < bufsz - 1) break;
+                        nl = inbuf + inlen; /* over-long line: take it as is */
+                    }
+                    size_t ll = nl - (inbuf + pos);
+                    memcpy(buf, inbuf + pos, ll);
+                    buf[ll] = '\0';
+                    pos += ll + (nl < inbuf + inlen);
+                    trim_newline(buf);
+
+                    if (buf[0] == '/') {
+                        /* "/word args": the word goes through the generated table */
+                        char *args = strchr(buf, ' ');
+                        size_t wl = args ? (size_t)(args - buf) : strlen(buf);
+                        if (args) args++;
+                        cmd_id_t sl = cmd_lookup(CMD_LAYER_SLASH, buf, wl);
+                        if (sl != CMD_NONE && cmd_takes_args(sl) != (args != NULL)) sl = CMD_NONE;
+                        switch (sl) {
+                        case SL_NICK:
+                            strncpy(username, args, sizeof(username)-1);
+                            snprintf(out, bufsz, "JOIN|%s|%s\n", username, room);
                             write(writefd, out, strlen(out));
+                            break;
+                        case SL_JOIN:
+                            strncpy(room, args, sizeof(room)-1);
+                            snprintf(out, bufsz, "JOIN|%s|%s\n", username, room);
+                            write(writefd, out, strlen(out));
+                            break;
+                        case SL_ROOMS:
+                            write(writefd, "ROOMS|\n", 7);
+                            break;
+                        case SL_HISTORY:
+                            snprintf(out, bufsz, "HISTORY|%s\n", room);
+                            write(writefd, out, strlen(out));
+                            break;
+                        case SL_MORE:
+                            snprintf(out, bufsz, "MORE|%s\n", room);
+                            write(writefd, out, strlen(out));
+                            break;
+                        case SL_SEARCH:
+                            snprintf(out, bufsz, "SEARCH|%s|%s\n", room, args);
+                            write(writefd, out, strlen(out));
+                            break;
+                        case SL_PM: {
+                            char *sp = strchr(args, ' ');
+                            if (!sp) write(sock, "Usage: /pm <user> <msg>\n", 25);
+                            else {
+                                *sp = '\0';
+                                char *to = args;
+                                char *msg = sp + 1;
+                                snprintf(out, bufsz, "PM|%s|%s|%s\n", username, to, msg);
+                                write(writefd, out, strlen(out));
+                            }
+                            break;
+                        }
+                        case SL_APPEAL:
+                            /* allow muted users to send an appeal to admins */
+                            snprintf(out, bufsz, "APPEAL|%s|%s\n", username, args);
+                            write(writefd, out, strlen(out));
+                            break;
+                        case SL_ADMIN:
+                            /* send raw remainder as is (server will robustly parse) */
+                            snprintf(out, bufsz, "ADMIN|%s|%s\n", username, args);
+                            write(writefd, out, strlen(out));
+                            break;
+                        case SL_PONG:
+                            write(writefd, "PONG|\n", 6);
+                            break;
+                        case SL_QUIT:
+                            write(writefd, "QUIT|\n", 6);
+                            quit = true;
+                            break;
+                        default:
+                            write(sock, "Unknown command\n", 16);
+                            break;
                         }
-                    }
-                    else if (!strncmp(buf, "/appeal ", 8)) {
-                        /* allow muted users to send an appeal to admins */
-                        char out[BUF];
-                        /* send APPEAL|<username>|<message> to parent */
-                        snprintf(out, sizeof(out), "APPEAL|%s|%s\n", username, buf + 8);
-                        write(writefd, out, strlen(out));
-                    }
- else if (!strncmp(buf, "/admin ", 7)) {
-                        /* send raw remainder as is (server will robustly parse) */
-                        char out[BUF];
-                        snprintf(out, sizeof(out), "ADMIN|%s|%s\n", username, buf + 7);
-                        write(writefd, out, strlen(out));
-                    } else if (!strcmp(buf, "/quit")) {
-                        write(writefd, "QUIT|\n", 6);
-                        break;
-                    } else {
-                        write(sock, "Unknown command\n", 16);
-                    }
-                } else {
-                    /* normal message: safe truncation */
-                    char out[BUF];
-                    size_t msg_max = BUF - 128;
-                    char msg_trunc[BUF];
-                    if (strlen(buf) >= msg_max) {
-                        memcpy(msg_trunc, buf, msg_max - 1);
-                        msg_trunc[msg_max - 1] = '\0';
                     } else {
-                        strcpy(msg_trunc, buf);
+                        /* normal message: safe truncation */
+                        size_t msg_max = bufsz - 128;
+                        if (strlen(buf) >= msg_max) {
+                            memcpy(msg_trunc, buf, msg_max - 1);
+                            msg_trunc[msg_max - 1] = '\0';
+                        } else {
+                            strcpy(msg_trunc, buf);
+                        }
+                        /* a TS frame ahead of the MSG lets the parent time the pipe hop */
+                        int off = 0;
+                        if (recv_ns)
+                            off = snprintf(out, bufsz, "TS|%llu\n", (unsigned long long)recv_ns);
+                        snprintf(out + off, bufsz - off, "MSG|%s|%s|%s\n", username, room, msg_trunc);
+                        write(writefd, out, strlen(out));
                     }
-                    snprintf(out, sizeof(out), "MSG|%s|%s|%s\n", username, room, msg_trunc);
-                    write(writefd, out, strlen(out));
                 }
+                memmove(inbuf, inbuf + pos, inlen - pos);
+                inlen -= pos;
+                if (quit) break;
             }
         }
 
@@ -629,58 +2409,497 @@ void accept_and_spawn() {
 
     /* parent */
     close(p2c[0]); close(c2p[1]);
+    fcntl(p2c[1], F_SETFL, fcntl(p2c[1], F_GETFL) | O_NONBLOCK);
     clients[slot].pid = pid;
-    clients[slot].to_child_fd = p2c[1];
-    clients[slot].from_child_fd = c2p[0];
-    clients[slot].username[0] = '\0';
-    clients[slot].room[0] = '\0';
-    clients[slot].connected = true;
+    conn_out_fd[slot] = p2c[1];
+    conn_in_fd[slot] = c2p[0];
+    clients[slot].user = ATOM_NONE;
+    conn_room[slot] = ATOM_NONE;
+    conn_ri[slot] = -1;
+    conn_live[slot] = true;
+    metric_add(M_ACCEPTS, 1);
+    flightrec_log(FR_ACCEPT, slot, NULL, pid, 0);
     clients[slot].muted = false;
-    writef(clients[slot].to_child_fd, "Welcome to MultiChat! Use /nick, /join, /pm, /rooms\n");
+    clients[slot].is_admin = false;
+    clients[slot].throttle_noticed = false;
+    limiter_set(&clients[slot].limiter, user_limit, false);
+    idle_start(slot);
+    client_printf(slot, "Welcome to MultiChat! Use /nick, /join, /pm, /rooms\n");
     close(ns);
 }
 
-/* ------------ MAIN ------------ */
-int main() {
-    signal(SIGINT, sigint_handler);
-    signal(SIGUSR1, sigusr1_handler);
+/* ------------ ADMISSION ------------ */
+/* New connections pass a token bucket before a child is forked for them.
+   Over the rate they either wait in the kernel's listen backlog (the
+   listener leaves the select set until a token is due) or, with
+   --accept-excess reject, are told when to retry and closed. */
+static tbucket_t admit;
+static unsigned admit_rejected; /* turned away since the last admission */
+static bool admit_paused;       /* listener out of the select set */
+static twheel_timer_t admit_timer;
+
+static void admission_resume(twheel_timer_t *t) {
+    (void)t;
+    admit_paused = false;
+}
 
-    for (int i = 0; i < MAX_CLIENTS; ++i) {
-        clients[i].connected = false;
-        clients[i].muted = false;
-        clients[i].is_admin = false;
+static void admission_init(void) {
+    tbucket_init(&admit, accept_rate, accept_burst ? accept_burst : 2.0 * accept_rate, metrics_now_ns());
+    admit_timer.fn = admission_resume;
+}
+
+static void reject_client(int ns) {
+    /* spread the retries: each one turned away waits for one more token */
+    uint64_t ms = tbucket_wait_ns(&admit, 1 + admit_rejected++) / 1000000 + 1;
+    if (ms > RETRY_HINT_MAX_MS) ms = RETRY_HINT_MAX_MS;
+    char msg[64];
+    int n = snprintf(msg, sizeof(msg), "Server busy, retry in %llu ms\n", (unsigned long long)ms);
+    if (write(ns, msg, n) < 0) {} /* best effort; the socket never blocks */
+    close(ns);
+    metric_add(M_ADMIT_REJECTS, 1);
+}
+
+/* drain the listener: up to accept_budget connections per readiness */
+static void accept_connections(void) {
+    uint64_t now = metrics_now_ns();
+    for (unsigned k = 0; k < accept_budget; ++k) {
+        if (!accept_reject && !tbucket_take(&admit, 1, now)) {
+            /* the rest stay queued in the backlog until a token is due */
+            admit_paused = true;
+            twheel_arm(&admit_timer, tbucket_wait_ns(&admit, 1) / 1000000);
+            metric_add(M_ADMIT_WAITS, 1);
+            return;
+        }
+        struct sockaddr_in cli;
+        socklen_t sz = sizeof(cli);
+        int ns = accept4(listen_fd, (struct sockaddr *)&cli, &sz, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (ns < 0) {
+            if (!accept_reject) tbucket_put(&admit, 1); /* not used after all */
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return; /* EAGAIN: drained; EMFILE and friends: next pass */
+        }
+        if (accept_reject && !tbucket_take(&admit, 1, now)) {
+            reject_client(ns);
+            continue;
+        }
+        admit_rejected = 0;
+        spawn_client(ns);
     }
-    for (int i = 0; i < MAX_CLIENTS; ++i) last_appeal_msg[i][0] = '\0';
-    add_room_if_missing("lobby");
+}
 
-    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_fd < 0) { perror("socket"); exit(1); }
+/* ------------ MAIN ------------ */
+static int open_listener(bool reuseport) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) { perror("socket"); exit(1); }
 
     int opt = 1;
-    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (reuseport) setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
 
     struct sockaddr_in srv = {0};
     srv.sin_family = AF_INET;
-    srv.sin_port = htons(PORT);
-    srv.sin_addr.s_addr = INADDR_ANY;
+    srv.sin_port = htons(chat_port);
+    inet_pton(AF_INET, bind_addr, &srv.sin_addr);
 
-    if (bind(listen_fd, (struct sockaddr *)&srv, sizeof(srv)) < 0) { perror("bind"); exit(1); }
-    if (listen(listen_fd, BACKLOG) < 0) { perror("listen"); exit(1); }
+    if (bind(fd, (struct sockaddr *)&srv, sizeof(srv)) < 0) { perror("bind"); exit(1); }
+    if (listen(fd, listen_backlog) < 0) { perror("listen"); exit(1); }
+    return fd;
+}
 
-    printf("Server listening on %d...\n", PORT);
+/* fork shards 1..n-1, each with its own listener on the shared port;
+   every process returns here as a complete server for its own shard */
+static void spawn_shards(unsigned n) {
+    int listeners[BUS_MAX_SHARDS];
+    for (unsigned k = 0; k < n; ++k) listeners[k] = open_listener(true);
+    if (bus_init(n) < 0) { perror("bus"); exit(1); }
+
+    unsigned self = 0;
+    for (unsigned k = 1; k < n && self == 0; ++k) {
+        pid_t pid = fork();
+        if (pid < 0) { perror("fork"); exit(1); }
+        if (pid == 0) {
+            prctl(PR_SET_PDEATHSIG, SIGINT); /* go down with shard 0 */
+            self = k;
+        } else {
+            shard_pids[k] = pid;
+        }
+    }
+    bus_attach(self);
+    for (unsigned k = 0; k < n; ++k)
+        if (k != self) close(listeners[k]);
+    listen_fd = listeners[self];
+    if (self != 0) memset(shard_pids, 0, sizeof(shard_pids));
+    printf("Shard %u of %u (pid %d)\n", self, n, (int)getpid());
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -c, --config PATH    read settings from PATH (default server.conf,\n"
+            "                       if present); flags override the file\n"
+            "  -b, --bind ADDR      chat listen address (default 0.0.0.0)\n"
+            "  -p, --port N         chat port (default 12345)\n"
+            "      --backlog N      listen backlog (default 4096)\n"
+            "      --max-clients N  connections served at once (default 256)\n"
+            "      --max-rooms N    rooms tracked at once (default 256)\n"
+            "      --line-max N     longest line a client may send (default 8192)\n"
+            "      --logdir DIR     room logs and dumps (default logs)\n"
+            "      --admin-password PW  (default admin123; prefer the config file)\n"
+            "      --accept-budget N  connections accepted per loop pass (default 64)\n"
+            "      --accept-rate N  new connections admitted per second, 0 for no\n"
+            "                       limit (default 200)\n"
+            "      --accept-burst N admitted at once before the rate applies\n"
+            "                       (default twice the rate)\n"
+            "      --accept-excess queue|reject  over the rate, leave connections\n"
+            "                       in the listen backlog (default) or close them\n"
+            "                       with a retry hint\n"
+            "      --user-rate M[,B]  messages (and bytes) per second one\n"
+            "                       connection may send (default 5,16384); 0 in either\n"
+            "                       is no limit on it, and a bare 0 is no limit at all\n"
+            "      --room-rate M[,B]  the same for each room (default 100,262144)\n"
+            "      --rate-burst N   seconds of rate a sender can save up (default 2)\n"
+            "      --keepalive N    send PING after N quiet seconds, 0 never (default 30)\n"
+            "      --idle-timeout N drop connections quiet for N seconds, 0 never\n"
+            "                       (default 90)\n"
+            "      --presence-batch N  rooms with N or more members get joins and\n"
+            "                       leaves as one summary per window (default 50,\n"
+            "                       0 always)\n"
+            "      --presence-window MS  how long a summary collects (default 1000)\n"
+            "      --history-preload N  recent lines sent on /join, 0 none (default 10)\n"
+            "      --history-page N lines per /more (default 50)\n"
+            "      --history-cache N  recent lines kept in memory per room\n"
+            "                       (default 200)\n"
+            "  -m, --metrics ADDR   serve Prometheus metrics on ADDR: a port,\n"
+            "                       host:port, or a UNIX socket path\n"
+            "  -t, --trace-sample N record stage timestamps for 1 in N messages\n"
+            "  -w, --words PATH     profanity word list (default filter.words)\n"
+            "  -f, --filter-threads N  filter long messages on N worker threads\n"
+            "                       (default: one less than the CPUs, at most 4)\n"
+            "  -s, --shards N       run N processes, each routing its share of\n"
+            "                       the rooms (default 1)\n"
+            "  -L, --peer-listen ADDR  accept federated servers on ADDR (port or\n"
+            "                       host:port, host defaults to 127.0.0.1)\n"
+            "  -P, --peer ADDR      federate with the server at ADDR; repeat for\n"
+            "                       each peer\n"
+            "  -U, --handoff PATH   hot restart socket: take over from a server\n"
+            "                       already listening on PATH, then listen on it\n"
+            "  -h, --help           show this help\n", prog);
+}
+
+enum {
+    OPT_BACKLOG = 256, OPT_MAX_CLIENTS, OPT_MAX_ROOMS, OPT_LINE_MAX, OPT_LOGDIR, OPT_ADMIN_PASSWORD,
+    OPT_ACCEPT_BUDGET, OPT_ACCEPT_RATE, OPT_ACCEPT_BURST, OPT_ACCEPT_EXCESS,
+    OPT_USER_RATE, OPT_ROOM_RATE, OPT_RATE_BURST, OPT_KEEPALIVE, OPT_IDLE_TIMEOUT,
+    OPT_PRESENCE_BATCH, OPT_PRESENCE_WINDOW, OPT_HISTORY_PRELOAD, OPT_HISTORY_PAGE, OPT_HISTORY_CACHE
+};
+
+static const struct option long_opts[] = {
+    {"config", required_argument, NULL, 'c'},
+    {"bind", required_argument, NULL, 'b'},
+    {"port", required_argument, NULL, 'p'},
+    {"backlog", required_argument, NULL, OPT_BACKLOG},
+    {"max-clients", required_argument, NULL, OPT_MAX_CLIENTS},
+    {"max-rooms", required_argument, NULL, OPT_MAX_ROOMS},
+    {"line-max", required_argument, NULL, OPT_LINE_MAX},
+    {"logdir", required_argument, NULL, OPT_LOGDIR},
+    {"admin-password", required_argument, NULL, OPT_ADMIN_PASSWORD},
+    {"accept-budget", required_argument, NULL, OPT_ACCEPT_BUDGET},
+    {"accept-rate", required_argument, NULL, OPT_ACCEPT_RATE},
+    {"accept-burst", required_argument, NULL, OPT_ACCEPT_BURST},
+    {"accept-excess", required_argument, NULL, OPT_ACCEPT_EXCESS},
+    {"user-rate", required_argument, NULL, OPT_USER_RATE},
+    {"room-rate", required_argument, NULL, OPT_ROOM_RATE},
+    {"rate-burst", required_argument, NULL, OPT_RATE_BURST},
+    {"keepalive", required_argument, NULL, OPT_KEEPALIVE},
+    {"idle-timeout", required_argument, NULL, OPT_IDLE_TIMEOUT},
+    {"presence-batch", required_argument, NULL, OPT_PRESENCE_BATCH},
+    {"presence-window", required_argument, NULL, OPT_PRESENCE_WINDOW},
+    {"history-preload", required_argument, NULL, OPT_HISTORY_PRELOAD},
+    {"history-page", required_argument, NULL, OPT_HISTORY_PAGE},
+    {"history-cache", required_argument, NULL, OPT_HISTORY_CACHE},
+    {"metrics", required_argument, NULL, 'm'},
+    {"trace-sample", required_argument, NULL, 't'},
+    {"words", required_argument, NULL, 'w'},
+    {"filter-threads", required_argument, NULL, 'f'},
+    {"shards", required_argument, NULL, 's'},
+    {"peer-listen", required_argument, NULL, 'L'},
+    {"peer", required_argument, NULL, 'P'},
+    {"handoff", required_argument, NULL, 'U'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0},
+};
+#define SHORT_OPTS "c:b:p:m:t:w:f:s:L:P:U:h"
+
+static bool filter_threads_set = false;
+static unsigned shards = 1;
+static const char *peer_listen_addr = NULL;
+static const char *peer_addrs[PEER_MAX];
+static int n_peer_addrs = 0;
+
+/* one setting from the command line or the config file; -1 if invalid */
+static int apply_option(int c, const char *arg) {
+    long v = 0;
+    switch (c) {
+    case 'b': {
+        struct in_addr a;
+        if (inet_pton(AF_INET, arg, &a) != 1) return -1;
+        bind_addr = arg;
+        break;
+    }
+    case 'p': if ((v = parse_num(arg, 1, 65535)) < 0) return -1; chat_port = v; break;
+    case OPT_BACKLOG: if ((v = parse_num(arg, 1, 65535)) < 0) return -1; listen_backlog = v; break;
+    case OPT_MAX_CLIENTS:
+        /* select() watches two pipes per connection below FD_SETSIZE */
+        if ((v = parse_num(arg, 1, (FD_SETSIZE - 64) / 2)) < 0) return -1;
+        max_clients = v;
+        break;
+    case OPT_MAX_ROOMS: if ((v = parse_num(arg, 1, 65536)) < 0) return -1; max_rooms = v; break;
+    case OPT_LINE_MAX:
+        /* frames to the parent must fit its largest pool buffer */
+        if ((v = parse_num(arg, 1024, pool_class_size[POOL_CLASSES - 1])) < 0) return -1;
+        line_max = v;
+        break;
+    case OPT_LOGDIR: if (!*arg) return -1; logdir = arg; break;
+    case OPT_ADMIN_PASSWORD: if (!*arg) return -1; admin_password = arg; break;
+    case OPT_ACCEPT_BUDGET: if ((v = parse_num(arg, 1, 65536)) < 0) return -1; accept_budget = v; break;
+    case OPT_ACCEPT_RATE: if ((v = parse_num(arg, 0, 1000000)) < 0) return -1; accept_rate = v; break;
+    case OPT_ACCEPT_BURST: if ((v = parse_num(arg, 0, 1000000)) < 0) return -1; accept_burst = v; break;
+    case OPT_ACCEPT_EXCESS:
+        if (strcmp(arg, "queue") == 0) accept_reject = false;
+        else if (strcmp(arg, "reject") == 0) accept_reject = true;
+        else return -1;
+        break;
+    case OPT_USER_RATE: return parse_rate(arg, &user_limit);
+    case OPT_ROOM_RATE: return parse_rate(arg, &room_limit);
+    case OPT_RATE_BURST: if ((v = parse_num(arg, 1, 3600)) < 0) return -1; rate_burst = v; break;
+    case OPT_KEEPALIVE: if ((v = parse_num(arg, 0, 86400)) < 0) return -1; keepalive = v; break;
+    case OPT_IDLE_TIMEOUT: if ((v = parse_num(arg, 0, 86400 * 7)) < 0) return -1; idle_timeout = v; break;
+    case OPT_PRESENCE_BATCH: if ((v = parse_num(arg, 0, 1000000)) < 0) return -1; presence_batch = v; break;
+    case OPT_PRESENCE_WINDOW: if ((v = parse_num(arg, 10, 60000)) < 0) return -1; presence_window = v; break;
+    case OPT_HISTORY_PRELOAD: if ((v = parse_num(arg, 0, 10000)) < 0) return -1; history_preload = v; break;
+    case OPT_HISTORY_PAGE: if ((v = parse_num(arg, 1, 10000)) < 0) return -1; history_page = v; break;
+    case OPT_HISTORY_CACHE: if ((v = parse_num(arg, 0, 100000)) < 0) return -1; history_cache = v; break;
+    case 'm': metrics_addr = arg; break;
+    case 't': trace_set_sample((unsigned)strtoul(arg, NULL, 10)); break;
+    case 'w': words_path = arg; break;
+    case 'f':
+        if ((v = parse_num(arg, 0, FP_MAX_THREADS)) < 0) return -1;
+        filter_threads = v;
+        filter_threads_set = true;
+        break;
+    case 's': if ((v = parse_num(arg, 1, BUS_MAX_SHARDS)) < 0) return -1; shards = v; break;
+    case 'L': peer_listen_addr = arg; break;
+    case 'P':
+        if (n_peer_addrs == PEER_MAX) return -1;
+        peer_addrs[n_peer_addrs++] = arg;
+        break;
+    case 'U': handoff_path = arg; break;
+    default: return -1;
+    }
+    return 0;
+}
+
+static int apply_config(const char *key, const char *value) {
+    for (const struct option *o = long_opts; o->name; ++o)
+        if (strcmp(o->name, key) == 0)
+            return o->has_arg == required_argument && o->val != 'c' ? apply_option(o->val, value) : -1;
+    return -1;
+}
+
+/* size the connection and room tables once the limits are known */
+static void alloc_tables(void) {
+    conn_live = calloc(max_clients, sizeof(*conn_live));
+    conn_room = calloc(max_clients, sizeof(*conn_room));
+    conn_ri = calloc(max_clients, sizeof(*conn_ri));
+    conn_out_fd = calloc(max_clients, sizeof(*conn_out_fd));
+    conn_in_fd = calloc(max_clients, sizeof(*conn_in_fd));
+    conn_queued = calloc(max_clients, sizeof(*conn_queued));
+    clients = calloc(max_clients, sizeof(*clients));
+    free_slots = calloc(max_clients, sizeof(*free_slots));
+    rooms = calloc(max_rooms, sizeof(*rooms));
+    room_msgs = calloc(max_rooms, sizeof(*room_msgs));
+    room_shards = calloc(max_rooms, sizeof(*room_shards));
+    room_limiters = calloc(max_rooms, sizeof(*room_limiters));
+    room_presence_batch = calloc(max_rooms, sizeof(*room_presence_batch));
+    room_recent = calloc(max_rooms, sizeof(*room_recent));
+    bool ok = conn_live && conn_room && conn_ri && conn_out_fd && conn_in_fd && conn_queued && clients &&
+              free_slots && rooms && room_msgs && room_shards && room_limiters && room_presence_batch &&
+              room_recent;
+    for (int k = 0; ok && k < PEER_MAX && federated; ++k)
+        ok = (peer_rooms[k] = calloc(max_rooms, sizeof(*peer_rooms[k]))) != NULL;
+    /* every name that can hold an atom at once: the room list, a username
+       and a current room per connection, "global", and each peer's room
+       summary */
+    unsigned names = max_rooms + 2u * max_clients + 1 + (federated ? PEER_MAX * max_rooms : 0);
+    ok = ok && intern_init(names) == 0;
+    if (!ok) {
+        fprintf(stderr, "cannot allocate tables for %d clients and %d rooms\n", max_clients, max_rooms);
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    /* the config file first, so that flags override it */
+    const char *config_path = NULL;
+    int opt_c;
+    opterr = 0;
+    while ((opt_c = getopt_long(argc, argv, SHORT_OPTS, long_opts, NULL)) != -1)
+        if (opt_c == 'c') config_path = optarg;
+    if ((config_path || access(CONFIG_PATH, F_OK) == 0) &&
+        config_load(config_path ? config_path : CONFIG_PATH, apply_config) < 0)
+        return 1;
+    optind = 1;
+    opterr = 1;
+    while ((opt_c = getopt_long(argc, argv, SHORT_OPTS, long_opts, NULL)) != -1) {
+        if (opt_c == 'c') continue;
+        if (opt_c == 'h') { usage(argv[0]); return 0; }
+        if (opt_c == '?' || apply_option(opt_c, optarg) < 0) {
+            if (opt_c != '?') fprintf(stderr, "%s: bad value '%s'\n", argv[0], optarg);
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (shards > 1 && handoff_path) {
+        fprintf(stderr, "--handoff cannot be combined with --shards\n");
+        return 1;
+    }
+    federated = peer_listen_addr || n_peer_addrs > 0;
+    if (shards > 1 && federated) {
+        fprintf(stderr, "--peer and --peer-listen cannot be combined with --shards\n");
+        return 1;
+    }
+    /* a room summary lists every room in one peer frame */
+    if (federated && 8 + (size_t)max_rooms * (ATOM_MAX_LEN + 1) > PEER_FRAME_MAX) {
+        fprintf(stderr, "--max-rooms is limited to %d with federation\n",
+                (PEER_FRAME_MAX - 8) / (ATOM_MAX_LEN + 1));
+        return 1;
+    }
+    alloc_tables();
+
+    signal(SIGINT, sigint_handler);
+
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGUSR1);
+    sigaddset(&sigs, SIGHUP);
+    sigprocmask(SIG_BLOCK, &sigs, NULL);
+    signal_fd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd < 0) { perror("signalfd"); exit(1); }
+
+    signal(SIGPIPE, SIG_IGN); /* a dead child shows up as EPIPE/EOF instead */
+    ensure_logdir();
+    flightrec_init(logdir); /* SIGQUIT or a crash dumps logs/flight-<pid>.bin */
+
+    loop_ms = clock_ms();
+    twheel_init(loop_ms);
+    for (int i = max_clients - 1; i >= 0; --i) {
+        conn_live[i] = false;
+        clients[i].muted = false;
+        clients[i].is_admin = false;
+        clients[i].idle_timer = (twheel_timer_t){.fn = idle_check, .arg = (void *)(intptr_t)i};
+        clients[i].rate_timer = (twheel_timer_t){.fn = rate_resume, .arg = (void *)(intptr_t)i};
+        clients[i].hist_room = -1;
+        free_slots[free_top++] = i;
+    }
+    for (int i = 0; i < max_clients; ++i) clients[i].last_appeal[0] = '\0';
+    add_room_if_missing("lobby");
+    global_room = intern("global");
+    arena_reset();
+
+    int adopted = handoff_path ? handoff_takeover(handoff_path) : -1;
+    if (adopted >= 0) {
+        printf("Took over %d connections, listening on %d...\n", adopted, chat_port);
+    } else {
+        if (shards > 1) spawn_shards(shards);
+        else listen_fd = open_listener(false);
+        printf("Server listening on %d...\n", chat_port);
+    }
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+    admission_init();
+    if (handoff_path) {
+        handoff_fd = handoff_listen(handoff_path);
+        if (handoff_fd < 0) perror("handoff");
+        else printf("Hot restart socket %s\n", handoff_path);
+    }
+    int nwords = wordfilter_load(words_path);
+    if (nwords < 0) fprintf(stderr, "warning: cannot read %s, messages are not filtered\n", words_path);
+    else printf("Filter: %d words from %s\n", nwords, words_path);
+    if (!filter_threads_set) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        filter_threads = cpus > 1 ? (cpus - 1 > 4 ? 4 : (unsigned)cpus - 1) : 0;
+    }
+    if (filter_threads > 0) {
+        if (filterpool_start(filter_threads, max_rooms + max_clients, filter_in_place) < 0)
+            fprintf(stderr, "warning: no filter threads, filtering inline\n");
+        else printf("Filter threads: %u\n", filterpool_threads());
+    }
+    if (peer_listen_addr) {
+        if (peer_listen(peer_listen_addr) < 0) { perror("peer-listen"); exit(1); }
+        printf("Peers on %s\n", peer_listen_addr);
+    }
+    for (int k = 0; k < n_peer_addrs; ++k)
+        if (peer_add(peer_addrs[k]) < 0) { fprintf(stderr, "bad peer address %s\n", peer_addrs[k]); exit(1); }
+    if (metrics_addr && bus_self() == 0) {
+        if (httpd_open(metrics_addr, render_metrics) < 0) { perror("metrics"); exit(1); }
+        printf("Metrics on %s\n", metrics_addr);
+    }
 
     while (!shutdown_requested) {
-        fd_set s;
-        FD_ZERO(&s);
-        FD_SET(listen_fd, &s);
-        struct timeval tv = {1, 0};
-        int rv = select(listen_fd + 1, &s, NULL, NULL, &tv);
+        arena_reset();
+        /* one select for the listener, child pipes and pending output */
+        fd_set rfds, wfds;
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+        /* over the admission rate, new connections wait in the backlog */
+        if (!admit_paused) FD_SET(listen_fd, &rfds);
+        FD_SET(signal_fd, &rfds);
+        int maxfd = listen_fd > signal_fd ? listen_fd : signal_fd;
+        httpd_fds(&rfds, &wfds, &maxfd);
+        filterpool_fds(&rfds, &maxfd);
+        bus_fds(&rfds, &wfds, &maxfd);
+        if (federated) peer_fds(&rfds, &wfds, &maxfd);
+        if (handoff_fd >= 0) {
+            FD_SET(handoff_fd, &rfds);
+            if (handoff_fd > maxfd) maxfd = handoff_fd;
+        }
+        for (int i = 0; i < max_clients; ++i) {
+            if (!conn_live[i]) continue;
+            FD_SET(conn_in_fd[i], &rfds);
+            if (conn_in_fd[i] > maxfd) maxfd = conn_in_fd[i];
+            if (conn_queued[i]) {
+                FD_SET(conn_out_fd[i], &wfds);
+                if (conn_out_fd[i] > maxfd) maxfd = conn_out_fd[i];
+            }
+        }
+        uint64_t wait_ms = twheel_timeout_ms(1000);
+        struct timeval tv = {(time_t)(wait_ms / 1000), (suseconds_t)(wait_ms % 1000) * 1000};
+        int rv = select(maxfd + 1, &rfds, &wfds, NULL, &tv);
         if (rv < 0) {
             if (errno == EINTR) continue;
             break;
         }
-        if (FD_ISSET(listen_fd, &s)) accept_and_spawn();
-        handle_parent_messages();
+        uint64_t t_wake = metrics_now_ns();
+        loop_ms = t_wake / 1000000;
+        twheel_advance(loop_ms);
+        if (FD_ISSET(signal_fd, &rfds)) handle_signalfd();
+        if (FD_ISSET(listen_fd, &rfds)) accept_connections();
+        handle_parent_messages(&rfds, &wfds);
+        filterpool_handle(&rfds, deliver_filtered);
+        bus_handle(&rfds, &wfds, handle_bus_frame);
+        if (federated) peer_handle(&rfds, &wfds, handle_peer_frame, handle_peer_state);
+        httpd_handle(&rfds, &wfds);
+        if (handoff_fd >= 0 && FD_ISSET(handoff_fd, &rfds)) handoff_serve();
+        /* reap exited connection children and log compressors */
+        while (waitpid(-1, NULL, WNOHANG) > 0) {}
+        wordfilter_reclaim();
+        if (federated) {
+            /* one summary and one write per peer for this whole pass */
+            if (summary_dirty) send_summary(-1);
+            summary_dirty = false;
+            metric_add(M_PEER_WRITES, peer_flush());
+        }
+        flightrec_log(FR_LOOP, -1, NULL, rv, metrics_now_ns() - t_wake);
     }
 
     cleanup_and_exit();
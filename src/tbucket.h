@@ -0,0 +1,54 @@
+/* tbucket.h
+   Token bucket: holds up to burst tokens and refills at rate tokens per
+   second. The caller passes the time in, so one clock read serves any
+   number of buckets. A rate of 0 means unlimited.
+*/
+#ifndef TBUCKET_H
+#define TBUCKET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    double tokens;
+    double rate;  /* tokens per second */
+    double burst; /* most tokens the bucket holds */
+    uint64_t last_ns;
+} tbucket_t;
+
+static inline void tbucket_init(tbucket_t *b, double rate, double burst, uint64_t now_ns) {
+    b->rate = rate;
+    b->burst = burst < 1 ? 1 : burst;
+    b->tokens = b->burst;
+    b->last_ns = now_ns;
+}
+
+static inline void tbucket_refill(tbucket_t *b, uint64_t now_ns) {
+    if (now_ns <= b->last_ns) return;
+    b->tokens += (double)(now_ns - b->last_ns) * b->rate / 1e9;
+    if (b->tokens > b->burst) b->tokens = b->burst;
+    b->last_ns = now_ns;
+}
+
+/* takes n tokens if they are all there */
+static inline bool tbucket_take(tbucket_t *b, double n, uint64_t now_ns) {
+    if (b->rate <= 0) return true;
+    tbucket_refill(b, now_ns);
+    if (b->tokens < n) return false;
+    b->tokens -= n;
+    return true;
+}
+
+/* gives back n tokens taken but not used */
+static inline void tbucket_put(tbucket_t *b, double n) {
+    b->tokens += n;
+    if (b->tokens > b->burst) b->tokens = b->burst;
+}
+
+/* nanoseconds until n tokens are there, as of the last refill */
+static inline uint64_t tbucket_wait_ns(const tbucket_t *b, double n) {
+    if (b->rate <= 0 || b->tokens >= n) return 0;
+    return (uint64_t)((n - b->tokens) * 1e9 / b->rate) + 1;
+}
+
+#endif
@@ -0,0 +1,151 @@
+/* trace.c
+   The ring is multi-producer: a writer claims a slot with one fetch_add
+   and guards it with a per-slot sequence number (seqlock style), so a
+   reader racing a writer skips the slot instead of seeing a torn record.
+   Readers are rare (admin commands) and pay for sorting; writers pay one
+   atomic add and a 64-byte copy.
+*/
+#include "trace.h"
+#include "intern.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    _Atomic uint64_t seq; /* claim index + 1 once complete, 0 while written */
+    trace_rec_t rec;
+} trace_slot_t;
+
+static trace_slot_t ring[TRACE_RING];
+static _Atomic uint64_t ring_head = 0;
+static _Atomic unsigned sample_every = 0;
+static _Atomic uint64_t sample_tick = 0;
+
+static const struct {
+    const char *name;
+    trace_stage_t from, to;
+} intervals[] = {
+    {"pipe", TS_RECV, TS_PARSE},
+    {"filter", TS_PARSE, TS_FILTER},
+    {"log", TS_FILTER, TS_LOG},
+    {"fanout", TS_LOG, TS_FANOUT},
+};
+#define N_INTERVALS (sizeof(intervals) / sizeof(intervals[0]))
+
+void trace_set_sample(unsigned n) {
+    atomic_store_explicit(&sample_every, n, memory_order_relaxed);
+}
+
+unsigned trace_sample(void) {
+    return atomic_load_explicit(&sample_every, memory_order_relaxed);
+}
+
+bool trace_should_sample(void) {
+    unsigned n = trace_sample();
+    if (n == 0) return false;
+    return atomic_fetch_add_explicit(&sample_tick, 1, memory_order_relaxed) % n == 0;
+}
+
+void trace_submit(const trace_rec_t *r) {
+    uint64_t idx = atomic_fetch_add_explicit(&ring_head, 1, memory_order_relaxed);
+    trace_slot_t *s = &ring[idx & (TRACE_RING - 1)];
+    atomic_store_explicit(&s->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    s->rec = *r;
+    atomic_store_explicit(&s->seq, idx + 1, memory_order_release);
+}
+
+/* consistent copy of the ring, oldest first; caller frees */
+static trace_rec_t *snapshot(size_t *count) {
+    trace_rec_t *out = malloc(sizeof(*out) * TRACE_RING);
+    *count = 0;
+    if (!out) return NULL;
+    uint64_t head = atomic_load_explicit(&ring_head, memory_order_acquire);
+    uint64_t start = head > TRACE_RING ? head - TRACE_RING : 0;
+    for (uint64_t idx = start; idx < head; ++idx) {
+        trace_slot_t *s = &ring[idx & (TRACE_RING - 1)];
+        if (atomic_load_explicit(&s->seq, memory_order_acquire) != idx + 1) continue;
+        trace_rec_t r = s->rec;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&s->seq, memory_order_relaxed) != idx + 1) continue;
+        out[(*count)++] = r;
+    }
+    return out;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* first stamped stage, so records without a child stamp still get a total */
+static uint64_t first_stamp(const trace_rec_t *r) {
+    for (int s = 0; s < TS_STAGE_COUNT; ++s)
+        if (r->ts[s]) return r->ts[s];
+    return 0;
+}
+
+size_t trace_format(char *buf, size_t cap) {
+    size_t off = 0;
+#define OUT(...) do { \
+        int n_ = snprintf(buf + off, off < cap ? cap - off : 0, __VA_ARGS__); \
+        if (n_ > 0) off += (size_t)n_; \
+    } while (0)
+    size_t n;
+    trace_rec_t *recs = snapshot(&n);
+    uint64_t *d = recs ? malloc(sizeof(*d) * (n ? n : 1)) : NULL;
+    if (!d) {
+        free(recs);
+        OUT("trace: out of memory\n");
+        return off < cap ? off : (cap ? cap - 1 : 0);
+    }
+
+    unsigned every = trace_sample();
+    if (every) OUT("tracing 1 in %u messages, %zu records\n", every, n);
+    else OUT("tracing off, %zu records\n", n);
+    OUT("%-8s %8s %10s %10s %10s %10s\n", "stage", "count", "avg_ns", "p50_ns", "p99_ns", "max_ns");
+
+    for (size_t k = 0; k <= N_INTERVALS; ++k) {
+        size_t m = 0;
+        uint64_t sum = 0;
+        for (size_t j = 0; j < n; ++j) {
+            const trace_rec_t *r = &recs[j];
+            uint64_t a, b;
+            if (k < N_INTERVALS) { a = r->ts[intervals[k].from]; b = r->ts[intervals[k].to]; }
+            else { a = first_stamp(r); b = r->ts[TS_FANOUT]; }
+            if (!a || !b || b < a) continue;
+            d[m++] = b - a;
+            sum += b - a;
+        }
+        if (m == 0) continue;
+        qsort(d, m, sizeof(*d), cmp_u64);
+        OUT("%-8s %8zu %10llu %10llu %10llu %10llu\n",
+            k < N_INTERVALS ? intervals[k].name : "total", m,
+            (unsigned long long)(sum / m), (unsigned long long)d[m / 2],
+            (unsigned long long)d[m * 99 / 100], (unsigned long long)d[m - 1]);
+    }
+#undef OUT
+    free(d);
+    free(recs);
+    return off < cap ? off : (cap ? cap - 1 : 0);
+}
+
+int trace_dump(const char *path) {
+    size_t n;
+    trace_rec_t *recs = snapshot(&n);
+    if (!recs) return -1;
+    FILE *f = fopen(path, "w");
+    if (!f) { free(recs); return -1; }
+    fprintf(f, "# room fanout recv parse filter log fanout (CLOCK_MONOTONIC ns)\n");
+    for (size_t j = 0; j < n; ++j) {
+        const trace_rec_t *r = &recs[j];
+        fprintf(f, "%s %u", r->room ? atom_str(r->room) : "-", r->fanout);
+        for (int s = 0; s < TS_STAGE_COUNT; ++s) fprintf(f, " %llu", (unsigned long long)r->ts[s]);
+        fputc('\n', f);
+    }
+    fclose(f);
+    free(recs);
+    return (int)n;
+}
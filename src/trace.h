@@ -0,0 +1,47 @@
+/* trace.h
+   Sampled per-message stage timestamps. A sampled room message carries a
+   CLOCK_MONOTONIC stamp for each stage it passes through; finished records
+   go into a fixed lock-free ring that admin tools read back as per-stage
+   latency breakdowns.
+*/
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    TS_RECV,    /* connection child read the line off the socket */
+    TS_PARSE,   /* parent dispatched the MSG frame */
+    TS_FILTER,  /* profanity filter returned */
+    TS_LOG,     /* append_room_log() returned */
+    TS_FANOUT,  /* every recipient has the line queued or written */
+    TS_STAGE_COUNT
+} trace_stage_t;
+
+typedef struct {
+    uint32_t room;     /* atom */
+    uint32_t fanout;   /* recipients */
+    uint64_t ts[TS_STAGE_COUNT]; /* ns; 0 if the stage was not stamped */
+} trace_rec_t;
+
+#define TRACE_RING 4096 /* records kept, power of two */
+
+/* trace 1 in n messages; 0 turns tracing off */
+void trace_set_sample(unsigned n);
+unsigned trace_sample(void);
+
+/* true for the messages that should be traced at the current rate */
+bool trace_should_sample(void);
+
+/* publish a finished record; safe from any thread, never blocks */
+void trace_submit(const trace_rec_t *r);
+
+/* per-stage p50/p99/max over the records in the ring; returns bytes written */
+size_t trace_format(char *buf, size_t cap);
+
+/* raw records, one per line, oldest first; returns records written or -1 */
+int trace_dump(const char *path);
+
+#endif
@@ -0,0 +1,109 @@
+/* twheel.c
+   Timing wheel for twheel.h. Level L holds timers due 64^L to 64^(L+1)
+   ticks out, in the slot picked by bits 6L..6L+5 of their due tick. When
+   the level-0 index wraps, the next level-1 slot is spread out over
+   level 0, and so on up (the classic cascading wheel). A timer due past
+   the top level waits in its furthest slot and is cascaded back there
+   until it comes within reach.
+*/
+#include "twheel.h"
+
+#define TW_BITS 6
+#define TW_SLOTS (1u << TW_BITS)
+#define TW_MASK (TW_SLOTS - 1)
+#define TW_LEVELS 4
+#define TW_SPAN ((uint64_t)1 << (TW_BITS * TW_LEVELS)) /* ticks the wheel covers */
+
+static twheel_timer_t *slots[TW_LEVELS][TW_SLOTS];
+static uint64_t now_tick; /* last tick processed */
+static size_t armed;
+
+static void link_timer(twheel_timer_t *t) {
+    uint64_t at = t->due, delta = at - now_tick;
+    if (delta >= TW_SPAN) {
+        /* beyond the wheel: park it in the furthest slot, keeping its real
+           due tick; that slot's cascade links it again from there */
+        delta = TW_SPAN - 1;
+        at = now_tick + delta;
+    }
+    int level = 0;
+    while (level < TW_LEVELS - 1 && delta >= (uint64_t)1 << (TW_BITS * (level + 1))) level++;
+    twheel_timer_t **head = &slots[level][(at >> (TW_BITS * level)) & TW_MASK];
+    t->next = *head;
+    if (t->next) t->next->pprev = &t->next;
+    t->pprev = head;
+    *head = t;
+}
+
+static void unlink_timer(twheel_timer_t *t) {
+    *t->pprev = t->next;
+    if (t->next) t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+void twheel_init(uint64_t now_ms) {
+    now_tick = now_ms / TWHEEL_TICK_MS;
+}
+
+void twheel_arm(twheel_timer_t *t, uint64_t delay_ms) {
+    if (t->pprev) unlink_timer(t);
+    else armed++;
+    uint64_t ticks = (delay_ms + TWHEEL_TICK_MS - 1) / TWHEEL_TICK_MS;
+    t->due = now_tick + (ticks ? ticks : 1);
+    link_timer(t);
+}
+
+void twheel_cancel(twheel_timer_t *t) {
+    if (!t->pprev) return;
+    unlink_timer(t);
+    armed--;
+}
+
+/* move every timer in one slot down to where it now belongs */
+static void cascade(int level, unsigned idx) {
+    twheel_timer_t *t;
+    while ((t = slots[level][idx])) {
+        unlink_timer(t);
+        link_timer(t);
+    }
+}
+
+size_t twheel_advance(uint64_t now_ms) {
+    uint64_t target = now_ms / TWHEEL_TICK_MS;
+    size_t ran = 0;
+    if (armed == 0 && target > now_tick) now_tick = target; /* nothing to walk past */
+    while (now_tick < target) {
+        now_tick++;
+        /* on each wrap, bring the next slot of the level above down */
+        for (int level = 1; level < TW_LEVELS; ++level) {
+            if ((now_tick >> (TW_BITS * (level - 1))) & TW_MASK) break;
+            cascade(level, (now_tick >> (TW_BITS * level)) & TW_MASK);
+        }
+        twheel_timer_t **head = &slots[0][now_tick & TW_MASK], *t;
+        while ((t = *head)) {
+            unlink_timer(t);
+            armed--;
+            t->fn(t);
+            ran++;
+        }
+    }
+    return ran;
+}
+
+uint64_t twheel_timeout_ms(uint64_t cap) {
+    if (armed == 0) return cap;
+    /* the next busy level-0 slot, or the next cascade if there is none */
+    uint64_t ticks = TW_SLOTS - (now_tick & TW_MASK);
+    for (uint64_t d = 1; d < ticks; ++d)
+        if (slots[0][(now_tick + d) & TW_MASK]) {
+            ticks = d;
+            break;
+        }
+    uint64_t ms = ticks * TWHEEL_TICK_MS;
+    return ms < cap ? ms : cap;
+}
+
+size_t twheel_count(void) {
+    return armed;
+}
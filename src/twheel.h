@@ -0,0 +1,45 @@
+/* twheel.h
+   Hierarchical timing wheel for the event loop: four levels of 64 slots
+   over a 10 ms tick, covering about 46 hours. Arming and cancelling are
+   O(1) list operations on a timer the caller owns; twheel_advance()
+   touches only the slots that came due, and a timer far out is moved
+   down a level at most three times on its way. Longer delays still fire
+   on time; they are just carried over once per 46 hours.
+*/
+#ifndef TWHEEL_H
+#define TWHEEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TWHEEL_TICK_MS 10
+
+typedef struct twheel_timer {
+    struct twheel_timer *next, **pprev; /* pprev is NULL while not armed */
+    uint64_t due;                        /* tick it fires on */
+    void (*fn)(struct twheel_timer *t);
+    void *arg;
+} twheel_timer_t;
+
+/* start the clock at now_ms (any monotonic millisecond count) */
+void twheel_init(uint64_t now_ms);
+
+/* (re)arm t to run fn(t) delay_ms from the last advance; at least one
+   tick later, never earlier than asked */
+void twheel_arm(twheel_timer_t *t, uint64_t delay_ms);
+
+void twheel_cancel(twheel_timer_t *t);
+
+static inline bool twheel_armed(const twheel_timer_t *t) { return t->pprev != NULL; }
+
+/* run every timer due by now_ms; callbacks may arm and cancel timers.
+   Returns how many ran. */
+size_t twheel_advance(uint64_t now_ms);
+
+/* milliseconds until the wheel next needs an advance, at most cap */
+uint64_t twheel_timeout_ms(uint64_t cap);
+
+size_t twheel_count(void);
+
+#endif
@@ -0,0 +1,157 @@
+/* wordfilter.c
+   Quiescent-state reclamation in miniature. A reader publishes the epoch
+   it started in, then loads the live version; a reload swaps the pointer,
+   advances the epoch and parks the old version until no reader is still
+   inside an older epoch. Both sides use seq_cst on the publish/swap pair,
+   so a reader that saw the old pointer is guaranteed to be seen by the
+   reclaimer.
+*/
+#define _GNU_SOURCE
+#include "wordfilter.h"
+#include "matcher.h"
+
+#include <ctype.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_READERS 64   /* threads that ever filter */
+#define MAX_RETIRED 16   /* versions waiting for their grace period */
+#define MAX_LINE 256
+
+typedef struct {
+    matcher_t *m;
+    unsigned words;
+    unsigned gen;
+} version_t;
+
+static _Atomic(version_t *) live = NULL;
+static _Atomic uint64_t epoch = 1;
+static _Atomic uint64_t reader_epoch[MAX_READERS]; /* 0 while quiescent */
+static _Atomic int n_readers = 0;
+static __thread int reader_slot = -1;
+static unsigned generation = 0;
+
+/* only touched by the thread that reloads */
+static struct {
+    version_t *v;
+    uint64_t epoch; /* first epoch in which v was no longer live */
+} retired[MAX_RETIRED];
+static int n_retired = 0;
+
+static int cmp_str(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void version_free(version_t *v) {
+    if (!v) return;
+    matcher_free(v->m);
+    free(v);
+}
+
+/* read, trim, lowercase, sort and dedupe the list */
+static char **read_words(const char *path, size_t *count) {
+    FILE *f = fopen(path, "r");
+    if (!f) return NULL;
+    size_t n = 0, cap = 64;
+    char **w = malloc(cap * sizeof(*w));
+    char line[MAX_LINE];
+    while (w && fgets(line, sizeof(line), f)) {
+        char *s = line, *e = line + strlen(line);
+        while (*s && isspace((unsigned char)*s)) s++;
+        while (e > s && isspace((unsigned char)e[-1])) e--;
+        *e = '\0';
+        if (!*s || *s == '#') continue;
+        for (char *c = s; *c; ++c) *c = tolower((unsigned char)*c);
+        if (n == cap) {
+            char **nw = realloc(w, (cap *= 2) * sizeof(*w));
+            if (!nw) break;
+            w = nw;
+        }
+        if (!(w[n] = strdup(s))) break;
+        n++;
+    }
+    fclose(f);
+    if (!w) return NULL;
+    qsort(w, n, sizeof(*w), cmp_str);
+    size_t u = 0;
+    for (size_t k = 0; k < n; ++k) {
+        if (u > 0 && strcmp(w[u - 1], w[k]) == 0) { free(w[k]); continue; }
+        w[u++] = w[k];
+    }
+    *count = u;
+    return w;
+}
+
+int wordfilter_load(const char *path) {
+    size_t n = 0;
+    char **words = read_words(path, &n);
+    if (!words) return -1;
+    version_t *v = calloc(1, sizeof(*v));
+    if (v) v->m = matcher_new((const char *const *)words, n);
+    for (size_t k = 0; k < n; ++k) free(words[k]);
+    free(words);
+    if (!v || !v->m) { version_free(v); return -1; }
+    v->words = (unsigned)n;
+    v->gen = ++generation;
+
+    version_t *old = atomic_exchange(&live, v);
+    uint64_t e = atomic_fetch_add(&epoch, 1) + 1;
+    if (old) {
+        wordfilter_reclaim();
+        if (n_retired == MAX_RETIRED) {
+            /* a reader is stuck; keep the leak bounded rather than block */
+            fprintf(stderr, "wordfilter: retired list full, leaking an old matcher\n");
+        } else {
+            retired[n_retired].v = old;
+            retired[n_retired].epoch = e;
+            n_retired++;
+        }
+    }
+    wordfilter_reclaim();
+    return (int)n;
+}
+
+void wordfilter_reclaim(void) {
+    if (n_retired == 0) return;
+    uint64_t oldest = UINT64_MAX;
+    int readers = atomic_load(&n_readers);
+    for (int k = 0; k < readers; ++k) {
+        uint64_t r = atomic_load(&reader_epoch[k]);
+        if (r && r < oldest) oldest = r;
+    }
+    int kept = 0;
+    for (int k = 0; k < n_retired; ++k) {
+        if (retired[k].epoch <= oldest) version_free(retired[k].v);
+        else retired[kept++] = retired[k];
+    }
+    n_retired = kept;
+}
+
+size_t wordfilter_apply(char *text, size_t len) {
+    if (reader_slot < 0) {
+        int s = atomic_fetch_add(&n_readers, 1);
+        if (s >= MAX_READERS) {
+            atomic_fetch_sub(&n_readers, 1);
+            return 0;
+        }
+        reader_slot = s;
+    }
+    atomic_store(&reader_epoch[reader_slot], atomic_load(&epoch));
+    version_t *v = atomic_load(&live);
+    size_t hits = v ? matcher_mask(v->m, text, len) : 0;
+    atomic_store_explicit(&reader_epoch[reader_slot], 0, memory_order_release);
+    return hits;
+}
+
+unsigned wordfilter_words(void) {
+    version_t *v = atomic_load(&live);
+    return v ? v->words : 0;
+}
+
+unsigned wordfilter_generation(void) {
+    version_t *v = atomic_load(&live);
+    return v ? v->gen : 0;
+}
@@ -0,0 +1,27 @@
+/* wordfilter.h
+   The live profanity matcher, built from a word list file and swapped
+   RCU-style on reload: readers take no locks, and a replaced matcher is
+   only freed once every reader that could still hold it has finished.
+*/
+#ifndef WORDFILTER_H
+#define WORDFILTER_H
+
+#include <stddef.h>
+
+/* (re)build the matcher from path (one word per line, '#' comments,
+   case-insensitive duplicates dropped) and publish it. Returns the number
+   of distinct words, or -1 if the file cannot be read; the previous
+   matcher stays live on failure. */
+int wordfilter_load(const char *path);
+
+/* mask text in place with the current matcher; returns matches */
+size_t wordfilter_apply(char *text, size_t len);
+
+/* free replaced matchers no reader can still see; cheap when idle */
+void wordfilter_reclaim(void);
+
+/* distinct words in the live matcher, and how many times it was loaded */
+unsigned wordfilter_words(void);
+unsigned wordfilter_generation(void);
+
+#endif